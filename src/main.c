@@ -1,8 +1,26 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <assert.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <limits.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <time.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*
  * Witcher Tracker Implementation
@@ -13,18 +31,22 @@
  * alchemy ingredients, potions, monster encounters, and knowledge acquisition.
  */
 
-#define MAX_INPUT_LENGTH 1024
-#define MAX_TOKEN_LENGTH 1024
-#define MAX_TOKENS 64
-#define MAX_NAME_LENGTH 1024
-#define MAX_ITEMS 1024
-#define MAX_INGREDIENTS 1024
-#define MAX_TROPHIES 1024
-#define MAX_POTIONS 1024    
-#define MAX_SIGNS 1024  
-#define MAX_BEASTS 1024
-#define MAX_EFFECTIVENESS 1024
-#define MAX_POTION_INGREDIENTS 1024
+#define READ_BUFFER_SIZE 65536
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+#define NAME_INLINE_LENGTH 8
+#define TABLE_CHUNK_BITS 8
+#define TABLE_CHUNK_SIZE (1 << TABLE_CHUNK_BITS)
+#define STOCK_LEVELS 16
+#define SCAN_WINDOW 64
+#define COMMAND_CACHE_SIZE 512
+#define COMMAND_CACHE_LINE_LENGTH 128
+#define COMMAND_CACHE_ITEMS 8
+#define PIPELINE_MAX_WORKERS 16
+#define PIPELINE_DEPTH 4
+#define PIPELINE_RING_SIZE 64
+#define PIPELINE_BATCH_LINES 1024
+#define PIPELINE_BATCH_BYTES 65536
+#define SCRATCH_BLOCK_BYTES 4096
 
 // Command types
 typedef enum {
@@ -49,1680 +71,2722 @@ typedef enum {
     CATEGORY_TROPHY
 } ItemCategory;
 
-bool isLootAction(const char* input);
-bool isTradeAction(const char* input);
-bool isBrewAction(const char* input);
-bool isEffectivenessKnowledge(const char* input);
-bool isPotionFormulaKnowledge(const char* input);
-bool isEncounterSentence(const char* input);
-bool isInventoryQuery(const char* input, bool* isSpecific);
-bool isBestiaryQuery(const char* input);
-bool isAlchemyQuery(const char* input);
-bool isExitCommand(const char* input);
-bool isValidCommand(const char* input, CommandType* cmdType);
-
-
-int executeLootAction(const char* input);
-int executeTradeAction(const char* input);
-int executeBrewAction(const char* input);
-int executeEffectivenessKnowledge(const char* input);
-int executeFormulaKnowledge(const char* input);
-int executeEncounter(const char* input);
-int executeSpecificInventoryQuery(const char* input);
-int executeAllInventoryQuery(const char* input);
-int executeBestiaryQuery(const char* input);
-int executeAlchemyQuery(const char* input);
-int executeCommand(const char* input, CommandType cmdType);
-int execute_line(const char* line);
+// Terminal symbols of the command grammar
+typedef enum {
+    TERM_END,           // End of the line
+    TERM_SPACE,         // A single ' '
+    TERM_BLANK,         // Any other run of whitespace
+    TERM_COMMA,
+    TERM_QUESTION,
+    TERM_NUMBER,        // A run of digits
+    TERM_OTHER,         // Any other character
+    TERM_WORD,          // A run of letters that is not a keyword
+    TERM_GERALT,        // Keywords
+    TERM_TOTAL,
+    TERM_WHAT,
+    TERM_EXIT,
+    TERM_LOOTS,
+    TERM_TRADES,
+    TERM_BREWS,
+    TERM_LEARNS,
+    TERM_ENCOUNTERS,
+    TERM_IS,
+    TERM_IN,
+    TERM_EFFECTIVE,
+    TERM_AGAINST,
+    TERM_FOR,
+    TERM_TROPHY,
+    TERM_SIGN,
+    TERM_POTION,
+    TERM_CONSISTS,
+    TERM_OF,
+    TERM_A,
+    TERM_INGREDIENT,
+    TERM_COUNT
+} Terminal;
+
+/**
+ * @brief A token as a slice of the input line.
+ *
+ * Tokens are never copied out of the line; they are described by the offset
+ * of their first character and their length.
+ */
+typedef struct {
+    int start;   /**< Offset of the token in the line */
+    int length;  /**< Number of characters in the token */
+} TokenSpan;
+
+/**
+ * @brief Character class bitmasks of a window of the line.
+ *
+ * Bit i of each mask describes the byte at `base + i`; bytes past the end
+ * of the line have no bit set.
+ */
+typedef struct {
+    int base;           /**< Offset of the window in the line */
+    uint64_t space;     /**< Whitespace bytes */
+    uint64_t letter;    /**< Letters */
+    uint64_t digit;     /**< Digits */
+} ScanWindow;
 
+/**
+ * @brief The lexer's position in a line.
+ */
+typedef struct {
+    const char* text;   /**< The line */
+    int length;         /**< Length of the line */
+    int pos;            /**< Offset of the next terminal */
+    ScanWindow window;  /**< Masks of the window around pos */
+} Scanner;
+
+/**
+ * @brief Interned entity name: 1, 2, ... for distinct names, 0 for none.
+ */
+typedef uint32_t NameId;
+
+/**
+ * @brief One "<quantity> <name>" entry of a loot, trade or formula list.
+ */
+typedef struct {
+    int quantity;    /**< Parsed quantity */
+    TokenSpan name;  /**< Name of the entry */
+    NameId nameId;   /**< Interned name of the entry */
+} CommandItem;
+
+/**
+ * @brief A parsed and validated input line.
+ *
+ * The line is parsed once; the parser fills in the command type and the
+ * spans and integers, and internCommandNames() the name IDs the executors
+ * need, so no executor has to look at the raw input again. Spans point into
+ * `text`, which must stay alive while the command is used.
+ *
+ * The entries live in a buffer the parser grows as needed and reuses from
+ * line to line, so a line may list any number of them.
+ */
+typedef struct {
+    CommandType type;                           /**< Recognized command type */
+    const char* text;                           /**< The line the spans point into */
+    ItemCategory category;                      /**< Category of an inventory query */
+    TokenSpan subject;                          /**< Potion, monster, item or counter name */
+    TokenSpan target;                           /**< Monster of an effectiveness statement */
+    NameId subjectId;                           /**< Interned subject */
+    NameId targetId;                            /**< Interned target */
+    bool counterIsSign;                         /**< Counter is a sign rather than a potion */
+    int itemCount;                              /**< Number of entries in items */
+    int tradeSplit;                             /**< Trades: entries before this are trophies */
+    CommandItem* items;                         /**< Loot, trade or formula entries */
+    size_t itemsCapacity;                       /**< Size of items in bytes */
+} Command;
+
+/**
+ * @brief Size of a stored command: the record followed by its entries.
+ *
+ * Stored commands (in the cache and in pipeline batches) keep only the
+ * entries in use, right after the record.
+ */
+#define COMMAND_SIZE(count) (sizeof(Command) + (size_t)(count) * sizeof(CommandItem))
+
+/**
+ * @brief A slot of the parsed-command cache.
+ *
+ * Holds a cleaned line and the result of parsing it: either a copy of the
+ * command, trimmed to its entries in use, or the fact that the line is
+ * invalid.
+ */
+typedef struct {
+    uint64_t hash;                                      /**< Hash of the line */
+    int length;                                         /**< Length of the line, 0 if the slot is free */
+    bool valid;                                         /**< The line parsed to a valid command */
+    int itemCount;                                      /**< Entries of the cached command */
+    char line[COMMAND_CACHE_LINE_LENGTH];               /**< The cleaned line */
+    unsigned char command[COMMAND_SIZE(COMMAND_CACHE_ITEMS)]; /**< The parsed command */
+} CommandCacheEntry;
+
+/**
+ * @brief Buffered reader that hands out input lines in place.
+ *
+ * Input is read in large blocks into a growable buffer. Each line is returned
+ * as a pointer into the buffer with its newline replaced by a NUL, so lines of
+ * any length are read without being copied; only the unfinished line at the
+ * end of a block is moved to the front before the next block is read.
+ */
+typedef struct {
+    int fd;             /**< File descriptor to read from */
+    char* buffer;       /**< Buffered input */
+    size_t capacity;    /**< Size of buffer */
+    size_t start;       /**< Offset of the next line */
+    size_t end;         /**< End of the buffered input */
+    size_t scanned;     /**< Bytes after start known to hold no newline */
+    bool eof;           /**< The input is exhausted */
+} LineReader;
+
+/**
+ * @brief A script file mapped into memory, read line by line in place.
+ */
+typedef struct {
+    const char* data;   /**< The mapped file */
+    size_t size;        /**< Size of the file */
+    size_t pos;         /**< Offset of the next line */
+} MappedScript;
+
+/**
+ * @brief A block of consecutive input lines and their parsed commands.
+ *
+ * Batches are the unit of work of the pipeline: the reader fills in the
+ * lines, a parser worker the commands, and the executor runs them.
+ */
+typedef struct {
+    const char* text;                               /**< Base the line offsets refer to */
+    char* buffer;                                   /**< Copy of the lines read from stdin */
+    size_t bufferLength;                            /**< Bytes used in buffer */
+    size_t bufferCapacity;                          /**< Size of buffer */
+    size_t lineStart[PIPELINE_BATCH_LINES];         /**< Offset of each line in text */
+    size_t lineLength[PIPELINE_BATCH_LINES];        /**< Length of each line */
+    long commandOffset[PIPELINE_BATCH_LINES];       /**< Offset of each command in commands, -1 if invalid */
+    int lineCount;                                  /**< Number of lines */
+    unsigned char* commands;                        /**< Parsed commands, each trimmed to COMMAND_SIZE */
+    size_t commandsLength;                          /**< Bytes used in commands */
+    size_t commandsCapacity;                        /**< Size of commands */
+    bool last;                                      /**< No batch follows this one */
+} CommandBatch;
+
+/**
+ * @brief Lock-free single-producer single-consumer queue of batches.
+ *
+ * head and tail only ever grow; the slot of a position is its value modulo
+ * PIPELINE_RING_SIZE. They live on separate cache lines so that producer and
+ * consumer do not contend.
+ */
+typedef struct {
+    _Alignas(64) atomic_size_t head;                /**< Next position to pop */
+    _Alignas(64) atomic_size_t tail;                /**< Next position to push */
+    CommandBatch* slots[PIPELINE_RING_SIZE];        /**< Queued batches */
+} BatchRing;
+
+/**
+ * @brief Reader, parser workers and executor of the pipeline mode.
+ *
+ * Batch k goes from the reader to worker k mod workerCount over
+ * toWorker[k mod workerCount], and from there to the executor over
+ * toExecutor[k mod workerCount], so the executor sees the batches in input
+ * order by visiting the workers' rings in turn. Executed batches go back to
+ * the reader over freeBatches. After the last batch the reader sends every
+ * worker a NULL batch, which ends it.
+ */
+typedef struct {
+    LineReader* reader;                             /**< Input from stdin, or NULL */
+    MappedScript* script;                           /**< Input from a mapped script, or NULL */
+    int workerCount;                                /**< Number of parser workers */
+    BatchRing toWorker[PIPELINE_MAX_WORKERS];       /**< Reader -> worker */
+    BatchRing toExecutor[PIPELINE_MAX_WORKERS];     /**< Worker -> executor */
+    BatchRing freeBatches;                          /**< Executor -> reader */
+} Pipeline;
+
+/**
+ * @brief Arguments of a parser worker thread.
+ */
+typedef struct {
+    Pipeline* pipeline;     /**< The pipeline */
+    int index;              /**< Which worker this is */
+} PipelineWorker;
+
+Terminal lookupKeyword(const char* word, int length);
+void compileGrammar(void);
+bool parseCommand(const char* input, int length, Command* cmd);
+bool parseCachedCommand(const char* input, int length, Command* cmd);
+NameId findName(const char* text, int length);
+NameId internName(const char* text, int length);
+const char* nameText(NameId id);
+void findCommandNames(Command* cmd);
+void internCommandNames(Command* cmd);
+
+
+int executeLootAction(const Command* cmd);
+int executeTradeAction(const Command* cmd);
+int executeBrewAction(const Command* cmd);
+int executeEffectivenessKnowledge(const Command* cmd);
+int executeFormulaKnowledge(const Command* cmd);
+int executeEncounter(const Command* cmd);
+int executeSpecificInventoryQuery(const Command* cmd);
+int executeAllInventoryQuery(const Command* cmd);
+int executeBestiaryQuery(const Command* cmd);
+int executeAlchemyQuery(const Command* cmd);
+int executeCommand(const Command* cmd);
+int execute_line(const char* line, size_t length);
+void flushOutput(void);
+void writeOutput(const char* data, size_t length);
+void initLineReader(LineReader* reader, int fd);
+char* readLine(LineReader* reader, size_t* length);
+bool openMappedScript(MappedScript* script, const char* path);
+const char* nextMappedLine(MappedScript* script, size_t* length);
+bool isExitLine(const char* line, size_t length);
+void runPipeline(LineReader* reader, MappedScript* script, int workerCount);
+
+// Parsed-command cache, enabled with --cache
+bool commandCacheEnabled = false;
+CommandCacheEntry commandCache[COMMAND_CACHE_SIZE];
+unsigned long commandCacheHits = 0;
+unsigned long commandCacheMisses = 0;
+
+// Output buffer; see writeOutput()
+char outputBuffer[OUTPUT_BUFFER_SIZE];
+size_t outputLength = 0;
+
+/**
+ * @brief Writes bytes to stdout, retrying short and interrupted writes.
+ *
+ * @param data The bytes to write.
+ * @param length Number of bytes.
+ */
+static void writeAll(const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = write(STDOUT_FILENO, data, length);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        data += n;
+        length -= n;
+    }
+}
+
+/**
+ * @brief Writes the buffered output to stdout.
+ */
+void flushOutput(void) {
+    writeAll(outputBuffer, outputLength);
+    outputLength = 0;
+}
+
+/**
+ * @brief Appends bytes to the output.
+ *
+ * Output is collected in one large buffer and written with write(2) only
+ * when the buffer fills, at a prompt, or at exit.
+ *
+ * @param data The bytes to write.
+ * @param length Number of bytes.
+ */
+void writeOutput(const char* data, size_t length) {
+    if (length > OUTPUT_BUFFER_SIZE - outputLength) {
+        flushOutput();
+        // Too large to buffer: write it straight from the caller
+        if (length > OUTPUT_BUFFER_SIZE) {
+            writeAll(data, length);
+            return;
+        }
+    }
+    memcpy(outputBuffer + outputLength, data, length);
+    outputLength += length;
+}
+
+/**
+ * @brief Appends a NUL-terminated string to the output.
+ *
+ * Inlined so that the length of a string literal is known at compile time.
+ *
+ * @param text The string.
+ */
+static inline void writeString(const char* text) {
+    writeOutput(text, strlen(text));
+}
+
+/**
+ * @brief Formats an integer in decimal, right-aligned in a buffer.
+ *
+ * @param value The integer.
+ * @param end End of a buffer of at least 11 characters.
+ * @return Start of the digits, which run up to end.
+ */
+static char* formatInt(int value, char* end) {
+    char* p = end;
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+
+    do {
+        *--p = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+
+    if (value < 0)
+        *--p = '-';
+    return p;
+}
+
+/**
+ * @brief Appends an integer in decimal to the output.
+ *
+ * @param value The integer.
+ */
+static void writeInt(int value) {
+    char digits[12];
+    char* p = formatInt(value, digits + sizeof(digits));
+    writeOutput(p, digits + sizeof(digits) - p);
+}
 
     // Function to clean up the input line
-void cleanInputLine(char* input) {
+const char* cleanInputLine(const char* input, size_t length, int* cleanLength) {
+    // The line ends at an embedded NUL, as it would as a C string
+    size_t len = strnlen(input, length);
+
     // Remove trailing newline if present
-    size_t len = strlen(input);
     if (len > 0 && input[len-1] == '\n') {
-        input[len-1] = '\0';
         len--;
     }
     
     // Trim leading spaces
-    int start = 0;
-    while (isspace((unsigned char)input[start])) start++;
+    size_t start = 0;
+    while (start < len && isspace((unsigned char)input[start])) start++;
     
-    if (start > 0) {
-        memmove(input, input + start, len - start + 1);
-        len -= start;
-    }
+    input += start;
+    len -= start;
     
     // Trim trailing spaces
     while (len > 0 && isspace((unsigned char)input[len-1])) {
-        input[--len] = '\0';
+        len--;
     }
+    
+    *cleanLength = (int)len;
+    return input;
 }
 
 
-int execute_line(const char* line) {
-    char inputCopy[MAX_INPUT_LENGTH];
-    strncpy(inputCopy, line, MAX_INPUT_LENGTH - 1);
-    inputCopy[MAX_INPUT_LENGTH - 1] = '\0';
-    
-    // Clean up the input (trim spaces, etc.)
-    cleanInputLine(inputCopy);
+int execute_line(const char* line, size_t length) {
+    // Clean up the input (trim spaces, etc.); the line itself is not modified
+    int cleanLength;
+    const char* input = cleanInputLine(line, length, &cleanLength);
     
-    if (strlen(inputCopy) == 0)
+    if (cleanLength == 0)
         return -1;
     
-    // Check if the command follows valid grammar
-    CommandType cmdType;
-    if (isValidCommand(inputCopy, &cmdType)) {
+    // Parse the line once; validation and execution share the result.
+    // The record keeps its entry buffer from line to line.
+    static Command cmd;
+    bool valid;
+    if (commandCacheEnabled) {
+        valid = parseCachedCommand(input, cleanLength, &cmd);
+    } else {
+        valid = parseCommand(input, cleanLength, &cmd);
+        if (valid)
+            internCommandNames(&cmd);
+    }
+    if (valid) {
         // Execute the command based on its type
-        return executeCommand(inputCopy, cmdType);
+        return executeCommand(&cmd);
     }
     
     return -1;
 }
 
-int main(void) {
+/**
+ * @brief Hashes a string of known length (64-bit FNV-1a).
+ *
+ * @param input The string.
+ * @param length Length of the string.
+ * @return The hash.
+ */
+static uint64_t hashText(const char* input, int length) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < length; i++) {
+        hash ^= (unsigned char)input[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
 
-    char line[MAX_INPUT_LENGTH];
+/**
+ * @brief Reports that memory ran out and ends the program.
+ */
+static void outOfMemory(void) {
+    fprintf(stderr, "Out of memory\n");
+    exit(EXIT_FAILURE);
+}
 
-    while (1) {
-        printf(">> ");
-        fflush(stdout);
+/**
+ * @brief realloc() that ends the program when memory runs out.
+ *
+ * @param memory The block to resize, or NULL for a new one.
+ * @param size Its new size in bytes.
+ * @return The resized block.
+ */
+static void* xrealloc(void* memory, size_t size) {
+    memory = realloc(memory, size);
+    if (memory == NULL)
+        outOfMemory();
+    return memory;
+}
 
-        if (fgets(line, sizeof(line), stdin) == NULL) {
-            break;
-        }
+/**
+ * @brief calloc() that ends the program when memory runs out.
+ *
+ * @param count Number of elements.
+ * @param size Size of each element.
+ * @return The zeroed block.
+ */
+static void* xcalloc(size_t count, size_t size) {
+    void* memory = calloc(count, size);
+    if (memory == NULL)
+        outOfMemory();
+    return memory;
+}
 
-        // Check for the exit command
-        if (strcmp(line, "Exit\n") == 0 || strcmp(line, "Exit") == 0) {
-            break;
-        }
+/**
+ * @brief Grows a buffer to hold at least the given number of bytes.
+ *
+ * @param buffer The buffer; replaced when it is moved.
+ * @param capacity Its size; updated when it grows.
+ * @param needed Number of bytes needed.
+ */
+static void reserveBuffer(void** buffer, size_t* capacity, size_t needed) {
+    if (needed <= *capacity)
+        return;
 
-        // Execute the command and handle result
-        int result = execute_line(line);
-        if (result == -1) {
-            printf("INVALID\n");
-        }
-    }
+    size_t size = *capacity > 0 ? *capacity : PIPELINE_BATCH_BYTES;
+    while (size < needed)
+        size *= 2;
 
-    return 0;
+    *buffer = xrealloc(*buffer, size);
+    *capacity = size;
 }
 
+/**
+ * @brief Grows a command's entry buffer to hold the given number of entries.
+ *
+ * Room for at least one entry is always made, so the buffer is never NULL
+ * and can be copied to and from even when the command has no entries.
+ *
+ * @param cmd The command.
+ * @param count Number of entries needed.
+ */
+static void reserveItems(Command* cmd, int count) {
+    reserveBuffer((void**)&cmd->items, &cmd->itemsCapacity, (size_t)(count > 0 ? count : 1) * sizeof(CommandItem));
+}
 
 /**
- * @brief Validates a given input string and determines its corresponding command type.
+ * @brief Parses a line, reusing the result for a line seen before.
  *
- * This function checks the input string against various possible command patterns,
- * such as actions (loot, trade, brew), knowledge queries (effectiveness, potion formula),
- * encounter statements, inventory and bestiary queries, alchemy questions, and exit commands.
- * 
- * If the input matches one of these command types, the corresponding `CommandType`
- * is set and the function returns true. Otherwise, it sets the type to `INVALID_COMMAND` and returns false.
+ * The cache is direct-mapped: each line has one slot, chosen by its hash, and
+ * a new line replaces whatever the slot held. Lines longer than
+ * COMMAND_CACHE_LINE_LENGTH and commands with more than COMMAND_CACHE_ITEMS
+ * entries are parsed every time. Name IDs never change, so a cached command
+ * keeps its interned names; names that are only looked up are looked up again.
  *
- * @param input The input command string to be validated.
- * @param cmdType Pointer to a CommandType variable where the detected command type will be stored.
- * 
- * @return true if the command is valid and recognized, false otherwise.
+ * @param input The cleaned input line; it need not be NUL-terminated.
+ * @param length Length of the line.
+ * @param cmd The command record to fill in.
+ * @return true if the line is a valid command, false otherwise.
  */
-bool isValidCommand(const char* input, CommandType* cmdType) {
-    if (isLootAction(input)) {
-        *cmdType = ACTION_LOOT;
-        return true;
-    } else if (isTradeAction(input)) {
-        *cmdType = ACTION_TRADE;
-        return true;
-    } else if (isBrewAction(input)) {
-        *cmdType = ACTION_BREW;
-        return true;
-    } else if (isEffectivenessKnowledge(input)) {
-        *cmdType = KNOWLEDGE_EFFECTIVENESS;
-        return true;
-    } else if (isPotionFormulaKnowledge(input)) {
-        *cmdType = KNOWLEDGE_POTION_FORMULA;
-        return true;
-    } else if (isEncounterSentence(input)) {
-        *cmdType = ENCOUNTER;
-        return true;
-    } else if (isInventoryQuery(input, &(bool){false})) {
-        bool isSpecific = false;
-        isInventoryQuery(input, &isSpecific);
-        *cmdType = isSpecific ? QUERY_SPECIFIC_INVENTORY : QUERY_ALL_INVENTORY;
-        return true;
-    } else if (isBestiaryQuery(input)) {
-        *cmdType = QUERY_BESTIARY;
-        return true;
-    } else if (isAlchemyQuery(input)) {
-        *cmdType = QUERY_ALCHEMY;
-        return true;
-    } else if (isExitCommand(input)) {
-        *cmdType = EXIT_COMMAND;
+bool parseCachedCommand(const char* input, int length, Command* cmd) {
+    uint64_t hash = hashText(input, length);
+    CommandCacheEntry* entry = &commandCache[hash % COMMAND_CACHE_SIZE];
+
+    if (entry->length == length && entry->hash == hash && memcmp(entry->line, input, length) == 0) {
+        commandCacheHits++;
+        if (!entry->valid)
+            return false;
+
+        // The spans are offsets, so they fit this copy of the line as well;
+        // the entries are copied into the command's own buffer
+        reserveItems(cmd, entry->itemCount);
+        CommandItem* items = cmd->items;
+        size_t itemsCapacity = cmd->itemsCapacity;
+        memcpy(cmd, entry->command, sizeof(Command));
+        memcpy(items, entry->command + sizeof(Command), (size_t)entry->itemCount * sizeof(CommandItem));
+        cmd->items = items;
+        cmd->itemsCapacity = itemsCapacity;
+        cmd->text = input;
+        findCommandNames(cmd);
         return true;
     }
-    
-    *cmdType = INVALID_COMMAND;
-    return false;
+
+    commandCacheMisses++;
+    bool valid = parseCommand(input, length, cmd);
+    if (valid)
+        internCommandNames(cmd);
+
+    if (length < COMMAND_CACHE_LINE_LENGTH && (!valid || cmd->itemCount <= COMMAND_CACHE_ITEMS)) {
+        entry->hash = hash;
+        entry->length = length;
+        entry->valid = valid;
+        memcpy(entry->line, input, length);
+        if (valid) {
+            entry->itemCount = cmd->itemCount;
+            memcpy(entry->command, cmd, sizeof(Command));
+            memcpy(entry->command + sizeof(Command), cmd->items, (size_t)cmd->itemCount * sizeof(CommandItem));
+        }
+    }
+
+    return valid;
 }
 
+/**
+ * @brief Prepares a line reader.
+ *
+ * @param reader The reader to initialize.
+ * @param fd File descriptor to read from.
+ */
+void initLineReader(LineReader* reader, int fd) {
+    reader->fd = fd;
+    reader->capacity = READ_BUFFER_SIZE;
+    reader->buffer = xrealloc(NULL, reader->capacity);
+    reader->start = 0;
+    reader->end = 0;
+    reader->scanned = 0;
+    reader->eof = false;
+}
 
 /**
- * @brief Checks if the given token is a valid positive integer.
+ * @brief Returns the next input line.
  *
- * A valid positive integer has no leading zeros (except "0" itself)
- * and consists only of digit characters.
+ * The line stays valid until the next call. A last line without a newline
+ * is returned as well.
  *
- * @param token The string to check.
- * @return true if the token is a positive integer, false otherwise.
+ * @param reader The reader.
+ * @param length Set to the length of the line, without its newline.
+ * @return The NUL-terminated line, or NULL at the end of the input.
  */
-bool isPositiveInteger(const char* token) {
-    if (token == NULL || *token == '\0') return false;
-    
-    // Check for leading zeros (except for a single "0")
-    if (token[0] == '0' && token[1] != '\0') return false;
-    
-    // Check if all characters are digits
-    for (int i = 0; token[i] != '\0'; i++) {
-        if (!isdigit(token[i])) return false;
+char* readLine(LineReader* reader, size_t* length) {
+    while (1) {
+        char* begin = reader->buffer + reader->start;
+        size_t available = reader->end - reader->start;
+
+        if (reader->scanned < available) {
+            char* newline = memchr(begin + reader->scanned, '\n', available - reader->scanned);
+            if (newline != NULL) {
+                *newline = '\0';
+                *length = newline - begin;
+                reader->start += *length + 1;
+                reader->scanned = 0;
+                return begin;
+            }
+            reader->scanned = available;
+        }
+
+        if (reader->eof) {
+            if (available == 0)
+                return NULL;
+
+            // The buffer always keeps one byte free for this NUL
+            begin[available] = '\0';
+            *length = available;
+            reader->start = reader->end;
+            reader->scanned = 0;
+            return begin;
+        }
+
+        // Make room: move the unfinished line to the front, or grow the buffer
+        // when the line fills all of it
+        if (reader->end + 1 >= reader->capacity) {
+            if (reader->start > 0) {
+                memmove(reader->buffer, begin, available);
+                reader->start = 0;
+                reader->end = available;
+            } else {
+                reader->capacity *= 2;
+                reader->buffer = xrealloc(reader->buffer, reader->capacity);
+            }
+            continue;
+        }
+
+        ssize_t n = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            reader->eof = true;
+        else
+            reader->end += n;
     }
-    
-    int value = atoi(token);
-    return value > 0;
 }
 
 /**
- * @brief Checks if the given token contains only alphabetic characters.
+ * @brief Maps a script file for reading.
  *
- * Returns true if all characters in the token are alphabetic (A-Z, a-z),
- * and the token is not NULL or empty.
+ * The file is mapped read-only and lines are handed out as spans of the
+ * mapping, so nothing is copied. The kernel is told the file is read
+ * front to back, so it reads ahead aggressively and can drop pages behind.
  *
- * @param token The string to validate.
- * @return true if the token is alphabetic only, false otherwise.
+ * @param script The script to initialize.
+ * @param path Path of the file.
+ * @return true on success, false if the file cannot be opened or mapped.
  */
-bool isAlphabeticOnly(const char* token) {
-    if (token == NULL || *token == '\0') return false;
-    
-    for (int i = 0; token[i] != '\0'; i++) {
-        if (!isalpha(token[i])) return false;
+bool openMappedScript(MappedScript* script, const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        return false;
     }
-    
+
+    script->data = NULL;
+    script->size = (size_t)info.st_size;
+    script->pos = 0;
+
+    // An empty file cannot be mapped, but it is a valid script
+    if (script->size > 0) {
+        void* data = mmap(NULL, script->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return false;
+        }
+        madvise(data, script->size, MADV_SEQUENTIAL);
+        script->data = data;
+    }
+
+    close(fd);
     return true;
 }
 
 /**
- * @brief Tokenizes the input string into an array of tokens.
- *
- * This function splits the input string into tokens based on whitespace and
- * specific keywords. It handles various command formats, including alchemy
- * queries, bestiary queries, and potion names.
- *
- * @param input The input string to tokenize.
- * @param tokens The array to store the resulting tokens.
- * @return The number of tokens parsed from the input string.
- */
-int tokenizeInput(const char* input, char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH]) {
-    int count = 0;
-    int inputLen = strlen(input);
-    int i = 0;
-
-    // Skip leading whitespace
-    while (i < inputLen && isspace(input[i])) i++;
-
-    // Handle question queries
-    if (i < inputLen && strncmp(input + i, "What", 4) == 0 && (isspace(input[i+4]) || input[i+4] == '\0')) {
-        strcpy(tokens[0], "What");
-        count = 1;
-        i += 4;
-        while (i < inputLen && isspace(input[i])) i++;
-
-        // Check for "is in" (alchemy query) or "is effective against" (bestiary query)
-        if (i < inputLen && strncmp(input + i, "is", 2) == 0 && (isspace(input[i+2]) || input[i+2] == '\0')) {
-            
-            strcpy(tokens[count++], "is");
-            i += 2;
-            while (i < inputLen && isspace(input[i])) i++;
-            
-            // Check for "in" (alchemy query)
-            if (i < inputLen && strncmp(input + i, "in", 2) == 0 && (isspace(input[i+2]) || input[i+2] == '\0')) {
-                
-                strcpy(tokens[count++], "in");
-                i += 2;
-                while (i < inputLen && isspace(input[i])) i++;
-                
-                // Read potion name
-                int potionStart = i;
-                int potionEnd = -1;
-                
-                for (int j = i; j < inputLen; j++) {
-                    if (input[j] == '?') {
-                        potionEnd = j;
-                        break;
-                    }
-                }
-                
-                if (potionEnd == -1) {
-
-                    potionEnd = inputLen;
-                }
-                
-                while (potionEnd > potionStart && isspace(input[potionEnd - 1])) {
-                    potionEnd--;
-                }
-                
-                int potionLen = potionEnd - potionStart;
-                if (potionLen >= MAX_TOKEN_LENGTH) return 0;
-                
-                strncpy(tokens[count], input + potionStart, potionLen);
-                tokens[count][potionLen] = '\0';
-                count++;
-                
-                // find question mark
-                while (i < inputLen && input[i] != '?') i++;
-                if (i < inputLen && input[i] == '?') {
-                    tokens[count][0] = '?';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++; 
-                    
-                    // Continue parsing after question mark to check for commas or other tokens
-                    while (i < inputLen && count < MAX_TOKENS) {
-                        while (i < inputLen && isspace(input[i])) i++;
-                        if (i >= inputLen) break;
-                        
-                        // Handle comma or any other character as a separate token
-                        if (input[i] == ',') {
-                            tokens[count][0] = ',';
-                            tokens[count][1] = '\0';
-                            count++;
-                            i++; 
-                            continue;
-                        }
-                        
-                        // Handle other tokens
-                        int tokenStart = i;
-                        while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                        int tokenLen = i - tokenStart;
-                        if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                            strncpy(tokens[count], input + tokenStart, tokenLen);
-                            tokens[count][tokenLen] = '\0';
-                            count++;
-                        }
-                    }
-                }
-                
-                return count;
-            }
-            // Check for "effective against" (bestiary query)
-            else if (i < inputLen && strncmp(input + i, "effective", 9) == 0 &&
-                    (isspace(input[i+9]) || input[i+9] == '\0')) {
-                
-                strcpy(tokens[count++], "effective");
-                i += 9;
-                while (i < inputLen && isspace(input[i])) i++;
-                
-                if (i < inputLen && strncmp(input + i, "against", 7) == 0 &&
-                    (isspace(input[i+7]) || input[i+7] == '\0')) {
-                    
-                    strcpy(tokens[count++], "against");
-                    i += 7;
-                    while (i < inputLen && isspace(input[i])) i++;
-                    
-                    // Read monster name 
-                    int monsterStart = i;
-                    int monsterEnd = -1;
-                    
-                    for (int j = i; j < inputLen; j++) {
-                        if (input[j] == '?') {
-                            monsterEnd = j;
-                            break;
-                        }
-                    }
-                    
-                    if (monsterEnd == -1) {
-                        monsterEnd = inputLen;
-                    }
-        
-                    while (monsterEnd > monsterStart && isspace(input[monsterEnd - 1])) {
-                        monsterEnd--;
-                    }
-                    
-                    int monsterLen = monsterEnd - monsterStart;
-                    if (monsterLen >= MAX_TOKEN_LENGTH) return 0;
-                    
-                    strncpy(tokens[count], input + monsterStart, monsterLen);
-                    tokens[count][monsterLen] = '\0';
-                    count++;
-                    
-                    // find question mark
-                    while (i < inputLen && input[i] != '?') i++;
-                    if (i < inputLen && input[i] == '?') {
-                        tokens[count][0] = '?';
-                        tokens[count][1] = '\0';
-                        count++;
-                        i++;
-                        
-                        while (i < inputLen && count < MAX_TOKENS) {
-                            while (i < inputLen && isspace(input[i])) i++;
-                            if (i >= inputLen) break;
-                            
-                            // Handle comma or any other character as a separate token
-                            if (input[i] == ',') {
-                                tokens[count][0] = ',';
-                                tokens[count][1] = '\0';
-                                count++;
-                                i++; 
-                                continue;
-                            }
-                            
-                            // Handle other tokens
-                            int tokenStart = i;
-                            while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                            int tokenLen = i - tokenStart;
-                            if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                                strncpy(tokens[count], input + tokenStart, tokenLen);
-                                tokens[count][tokenLen] = '\0';
-                                count++;
-                            }
-                        }
-                    }
-                    
-                    return count;
-                }
+ * @brief Returns the next line of a mapped script.
+ *
+ * @param script The script.
+ * @param length Set to the length of the line, without its newline.
+ * @return The line (not NUL-terminated), or NULL at the end of the script.
+ */
+const char* nextMappedLine(MappedScript* script, size_t* length) {
+    if (script->pos >= script->size)
+        return NULL;
+
+    const char* begin = script->data + script->pos;
+    size_t available = script->size - script->pos;
+    const char* newline = memchr(begin, '\n', available);
+
+    *length = newline != NULL ? (size_t)(newline - begin) : available;
+    script->pos += *length + 1;
+    return begin;
+}
+
+/**
+ * @brief Checks for the exit command.
+ *
+ * Only the exact line "Exit" ends the program; it is checked before the
+ * line is cleaned, so " Exit" or "Exit " are ordinary (invalid) commands.
+ *
+ * @param line The raw input line.
+ * @param length Length of the line.
+ * @return true if the line is the exit command, false otherwise.
+ */
+bool isExitLine(const char* line, size_t length) {
+    return length >= 4 && memcmp(line, "Exit", 4) == 0 && (length == 4 || line[4] == '\0');
+}
+
+/**
+ * @brief Waits a little longer each time a ring is found empty or full.
+ *
+ * Short waits spin, longer ones give up the CPU, so idle threads do not
+ * keep cores busy while the executor is the bottleneck.
+ *
+ * @param spins Number of times the caller has waited so far.
+ */
+static void pipelineBackoff(int* spins) {
+    if (++*spins < 64) {
+        return;
+    } else if (*spins < 128) {
+        sched_yield();
+    } else {
+        struct timespec pause = {0, 50000};
+        nanosleep(&pause, NULL);
+    }
+}
+
+/**
+ * @brief Appends a batch to a ring, waiting while the ring is full.
+ *
+ * @param ring The ring; only one thread may push to it.
+ * @param batch The batch to append.
+ */
+static void pushBatch(BatchRing* ring, CommandBatch* batch) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    int spins = 0;
+    while (tail - atomic_load_explicit(&ring->head, memory_order_acquire) == PIPELINE_RING_SIZE)
+        pipelineBackoff(&spins);
+    ring->slots[tail % PIPELINE_RING_SIZE] = batch;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief Removes the oldest batch from a ring, waiting while it is empty.
+ *
+ * @param ring The ring; only one thread may pop from it.
+ * @return The batch.
+ */
+static CommandBatch* popBatch(BatchRing* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    int spins = 0;
+    while (atomic_load_explicit(&ring->tail, memory_order_acquire) == head)
+        pipelineBackoff(&spins);
+    CommandBatch* batch = ring->slots[head % PIPELINE_RING_SIZE];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+    return batch;
+}
+
+/**
+ * @brief Reader thread: fills batches with input lines.
+ *
+ * Lines from a mapped script are referenced in place; lines from stdin are
+ * copied, since the line reader reuses its buffer. Reading stops at the end
+ * of the input or at the exit command, after which every worker is told to
+ * stop.
+ *
+ * @param arg The pipeline.
+ * @return NULL.
+ */
+static void* pipelineReader(void* arg) {
+    Pipeline* pipeline = arg;
+    bool done = false;
+
+    for (long k = 0; !done; k++) {
+        CommandBatch* batch = popBatch(&pipeline->freeBatches);
+        batch->lineCount = 0;
+        batch->bufferLength = 0;
+        // Keep the copy buffer non-NULL, even for a batch of empty lines
+        if (pipeline->script == NULL)
+            reserveBuffer((void**)&batch->buffer, &batch->bufferCapacity, 1);
+        batch->last = false;
+
+        while (batch->lineCount < PIPELINE_BATCH_LINES && batch->bufferLength < PIPELINE_BATCH_BYTES) {
+            size_t length;
+            const char* line = pipeline->script != NULL ? nextMappedLine(pipeline->script, &length)
+                                                        : readLine(pipeline->reader, &length);
+            if (line == NULL || isExitLine(line, length)) {
+                done = true;
+                break;
             }
-        }
 
-        const char* expected[] = { "is", "in" };
-        for (int j = 0; j < 2 && count < MAX_TOKENS; j++) {
-            int len = strlen(expected[j]);
-            if (strncmp(input + i, expected[j], len) == 0 &&
-                (isspace(input[i + len]) || input[i + len] == '\0')) {
-                strcpy(tokens[count++], expected[j]);
-                i += len;
-                while (i < inputLen && isspace(input[i])) i++;
+            int i = batch->lineCount++;
+            batch->lineLength[i] = length;
+            if (pipeline->script != NULL) {
+                batch->lineStart[i] = line - pipeline->script->data;
             } else {
-                return 0;
+                reserveBuffer((void**)&batch->buffer, &batch->bufferCapacity, batch->bufferLength + length);
+                memcpy(batch->buffer + batch->bufferLength, line, length);
+                batch->lineStart[i] = batch->bufferLength;
+                batch->bufferLength += length;
             }
         }
 
-        // Read potion name
-        int potionStart = i;
-        int potionEnd = -1;
+        batch->text = pipeline->script != NULL ? pipeline->script->data : batch->buffer;
+        batch->last = done;
+        pushBatch(&pipeline->toWorker[k % pipeline->workerCount], batch);
+    }
 
-        for (int j = i; j < inputLen; j++) {
-            if (input[j] == '?') {
-                potionEnd = j;
-                break;
-            }
-        }
+    for (int i = 0; i < pipeline->workerCount; i++)
+        pushBatch(&pipeline->toWorker[i], NULL);
 
-        if (potionEnd == -1) {
-            potionEnd = inputLen;
-        }
+    return NULL;
+}
 
-        while (potionEnd > potionStart && isspace(input[potionEnd - 1])) {
-            potionEnd--;
+/**
+ * @brief Parser worker thread: parses the lines of every batch it is given.
+ *
+ * Parsing does not touch the inventory or knowledge tables, so any number
+ * of workers can run alongside the executor. Each valid command is stored
+ * in the batch, trimmed to the entries it uses. The worker stops when it is
+ * given a NULL batch.
+ *
+ * @param arg The worker's PipelineWorker.
+ * @return NULL.
+ */
+static void* pipelineWorker(void* arg) {
+    PipelineWorker* worker = arg;
+    Pipeline* pipeline = worker->pipeline;
+    Command cmd = {0};
+    CommandBatch* batch;
+
+    while ((batch = popBatch(&pipeline->toWorker[worker->index])) != NULL) {
+        batch->commandsLength = 0;
+
+        for (int i = 0; i < batch->lineCount; i++) {
+            int length;
+            const char* input = cleanInputLine(batch->text + batch->lineStart[i], batch->lineLength[i], &length);
+
+            batch->commandOffset[i] = -1;
+            if (length == 0 || !parseCommand(input, length, &cmd))
+                continue;
+
+            // Keep every stored command aligned like a Command
+            size_t offset = (batch->commandsLength + _Alignof(Command) - 1) & ~(size_t)(_Alignof(Command) - 1);
+            size_t size = COMMAND_SIZE(cmd.itemCount);
+            reserveBuffer((void**)&batch->commands, &batch->commandsCapacity, offset + size);
+            memcpy(batch->commands + offset, &cmd, sizeof(Command));
+            memcpy(batch->commands + offset + sizeof(Command), cmd.items, (size_t)cmd.itemCount * sizeof(CommandItem));
+            batch->commandOffset[i] = (long)offset;
+            batch->commandsLength = offset + size;
         }
 
-        int potionLen = potionEnd - potionStart;
-        if (potionLen >= MAX_TOKEN_LENGTH) return 0;
+        pushBatch(&pipeline->toExecutor[worker->index], batch);
+    }
 
-        strncpy(tokens[count], input + potionStart, potionLen);
-        tokens[count][potionLen] = '\0';
-        count++;
+    free(cmd.items);
+    return NULL;
+}
 
-        // find question mark
-        while (i < inputLen && input[i] != '?') i++;
-        if (i < inputLen && input[i] == '?') {
-            tokens[count][0] = '?';
-            tokens[count][1] = '\0';
-            count++;
-            i++;
-            
-            // Continue parsing after question mark to check for commas or other tokens
-            while (i < inputLen && count < MAX_TOKENS) {
-                while (i < inputLen && isspace(input[i])) i++;
-                if (i >= inputLen) break;
-                
-                // Handle comma or any other character as a separate token
-                if (input[i] == ',') {
-                    tokens[count][0] = ',';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++;
-                    continue;
-                }
-                
-                // Handle other tokens
-                int tokenStart = i;
-                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                int tokenLen = i - tokenStart;
-                if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                    strncpy(tokens[count], input + tokenStart, tokenLen);
-                    tokens[count][tokenLen] = '\0';
-                    count++;
-                }
+/**
+ * @brief Runs the input through the reader / parser / executor pipeline.
+ *
+ * The calling thread is the executor: it runs the parsed commands strictly
+ * in input order, so the tables are only ever touched by one thread and the
+ * output is the same as in the serial loop. The reader and workers are
+ * joined, and the pipeline freed, before it returns.
+ *
+ * @param reader Input from stdin, or NULL.
+ * @param script Input from a mapped script, or NULL.
+ * @param workerCount Number of parser workers, 1 to PIPELINE_MAX_WORKERS.
+ */
+void runPipeline(LineReader* reader, MappedScript* script, int workerCount) {
+    // The rings are cache-line aligned, and the batches too large for the stack
+    size_t pipelineSize = (sizeof(Pipeline) + 63) & ~(size_t)63;
+    Pipeline* pipeline = aligned_alloc(64, pipelineSize);
+    if (pipeline == NULL)
+        outOfMemory();
+    CommandBatch* batches = xcalloc((size_t)workerCount * PIPELINE_DEPTH, sizeof(CommandBatch));
+    memset(pipeline, 0, pipelineSize);
+    PipelineWorker workers[PIPELINE_MAX_WORKERS];
+    pthread_t workerThreads[PIPELINE_MAX_WORKERS];
+    pthread_t readerThread;
+
+    pipeline->reader = reader;
+    pipeline->script = script;
+    pipeline->workerCount = workerCount;
+
+    for (int i = 0; i < workerCount * PIPELINE_DEPTH; i++)
+        pushBatch(&pipeline->freeBatches, &batches[i]);
+
+    for (int i = 0; i < workerCount; i++) {
+        workers[i] = (PipelineWorker){pipeline, i};
+        if (pthread_create(&workerThreads[i], NULL, pipelineWorker, &workers[i]) != 0) {
+            fprintf(stderr, "Cannot start parser thread\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (pthread_create(&readerThread, NULL, pipelineReader, pipeline) != 0) {
+        fprintf(stderr, "Cannot start reader thread\n");
+        exit(EXIT_FAILURE);
+    }
+
+    bool last = false;
+    for (long k = 0; !last; k++) {
+        CommandBatch* batch = popBatch(&pipeline->toExecutor[k % workerCount]);
+
+        for (int i = 0; i < batch->lineCount; i++) {
+            int result = -1;
+            if (batch->commandOffset[i] >= 0) {
+                // Names are interned here, since the name table is not shared with the workers
+                Command* cmd = (Command*)(batch->commands + batch->commandOffset[i]);
+                cmd->items = (CommandItem*)(cmd + 1);
+                internCommandNames(cmd);
+                result = executeCommand(cmd);
             }
+            if (result == -1)
+                writeString("INVALID\n");
         }
 
-        return count;
+        last = batch->last;
+        pushBatch(&pipeline->freeBatches, batch);
     }
 
-    // Handle Total queries
-    if (i < inputLen && strncmp(input + i, "Total", 5) == 0 && (isspace(input[i+5]) || input[i+5] == '\0')) {
+    pthread_join(readerThread, NULL);
+    for (int i = 0; i < workerCount; i++)
+        pthread_join(workerThreads[i], NULL);
 
-        strcpy(tokens[0], "Total");
-        count = 1;
-        i += 5;
-        while (i < inputLen && isspace(input[i])) i++;
+    for (int i = 0; i < workerCount * PIPELINE_DEPTH; i++) {
+        free(batches[i].buffer);
+        free(batches[i].commands);
+    }
+    free(batches);
+    free(pipeline);
+}
 
-        // Read category: potion / ingredient / trophy
-        char category[MAX_TOKEN_LENGTH];
-        int catStart = i;
-        while (i < inputLen && !isspace(input[i]) && input[i] != '?') i++;
-        int catLen = i - catStart;
-        if (catLen >= MAX_TOKEN_LENGTH) return 0;
+int main(int argc, char* argv[]) {
+
+    // Batch mode (no prompt, fully buffered output) is the default unless
+    // the input is a terminal; --prompt restores the interactive output
+    const char* scriptPath = NULL;
+    int promptFlag = -1;
+    int threadCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--cache") == 0) {
+            commandCacheEnabled = true;
+        } else if (strcmp(argv[i], "--batch") == 0) {
+            promptFlag = 0;
+        } else if (strcmp(argv[i], "--prompt") == 0) {
+            promptFlag = 1;
+        } else if (strcmp(argv[i], "--script") == 0 && i + 1 < argc) {
+            scriptPath = argv[++i];
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            char* end;
+            long count = strtol(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0' || count < 0 || count > PIPELINE_MAX_WORKERS) {
+                fprintf(stderr, "--threads takes 0 to %d parser threads\n", PIPELINE_MAX_WORKERS);
+                return EXIT_FAILURE;
+            }
+            threadCount = (int)count;
+        } else {
+            fprintf(stderr, "Usage: %s [--cache] [--batch | --prompt] [--script FILE] [--threads N]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
 
-        strncpy(category, input + catStart, catLen);
-        category[catLen] = '\0';
-        strcpy(tokens[count++], category);
+    bool interactive = promptFlag >= 0 ? promptFlag : (scriptPath == NULL && isatty(STDIN_FILENO));
 
-        while (i < inputLen && isspace(input[i])) i++;
+    // Whatever is still buffered is written out however the program ends
+    atexit(flushOutput);
 
-        // If the next character is '?', add it as a separate token
-        if (i < inputLen && input[i] == '?') {
-            tokens[count][0] = '?';
-            tokens[count][1] = '\0';
-            count++;
-            i++;
-            
-            // Continue parsing after question mark to check for commas or other tokens
-            while (i < inputLen && count < MAX_TOKENS) {
-                while (i < inputLen && isspace(input[i])) i++;
-                if (i >= inputLen) break;
-                
-                // Handle comma or any other character as a separate token
-                if (input[i] == ',') {
-                    tokens[count][0] = ',';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++; 
-                    continue;
-                }
-                
-                // Handle other tokens
-                int tokenStart = i;
-                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                int tokenLen = i - tokenStart;
-                if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                    strncpy(tokens[count], input + tokenStart, tokenLen);
-                    tokens[count][tokenLen] = '\0';
-                    count++;
-                }
-            }
-            
-            return count;
+    // Commands come from the mapped script if one is given, stdin otherwise
+    LineReader reader;
+    MappedScript script;
+    if (scriptPath != NULL) {
+        if (!openMappedScript(&script, scriptPath)) {
+            perror(scriptPath);
+            return EXIT_FAILURE;
         }
+    } else {
+        initLineReader(&reader, STDIN_FILENO);
+    }
 
-        // Return early if no more input
-        if (i >= inputLen) return count;
-
-        while (i < inputLen && isspace(input[i])) i++;
-
-        // Check if it's "Total <category> ?" or "Total <category> <item> ?"
-        if (i >= inputLen || input[i] == '?') {
-            tokens[count][0] = '?';
-            tokens[count][1] = '\0';
-            count++;
-            i++; 
-            
-            // Continue parsing after question mark to check for commas or other tokens
-            while (i < inputLen && count < MAX_TOKENS) {
-                while (i < inputLen && isspace(input[i])) i++;
-                if (i >= inputLen) break;
-                
-                // Handle comma or any other character as a separate token
-                if (input[i] == ',') {
-                    tokens[count][0] = ',';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++; 
-                    continue;
-                }
-                
-                // Handle other tokens
-                int tokenStart = i;
-                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                int tokenLen = i - tokenStart;
-                if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                    strncpy(tokens[count], input + tokenStart, tokenLen);
-                    tokens[count][tokenLen] = '\0';
-                    count++;
-                }
-            }
-            
-            return count;
+    compileGrammar();
+
+    // The pipeline reads ahead, so it is only used without a prompt; it
+    // parses in parallel, so it bypasses the (single-threaded) command cache
+    if (threadCount > 0 && !interactive) {
+        runPipeline(scriptPath == NULL ? &reader : NULL, scriptPath != NULL ? &script : NULL, threadCount);
+        return 0;
+    }
+
+    while (1) {
+        if (interactive) {
+            writeString(">> ");
+            flushOutput();
         }
 
-        // Read item name
-        int itemStart = i;
-        int itemEnd = -1;
-        for (int j = i; j < inputLen; j++) {
-            if (input[j] == '?') {
-                itemEnd = j;
-                break;
-            }
+        size_t length;
+        const char* line = scriptPath != NULL ? nextMappedLine(&script, &length)
+                                              : readLine(&reader, &length);
+        if (line == NULL) {
+            break;
         }
-        if (itemEnd == -1) itemEnd = inputLen;
-
-        // Trim trailing spaces
-        while (itemEnd > itemStart && isspace(input[itemEnd - 1])) itemEnd--;
-
-        // Check if the last word ends with '?'
-        if (input[itemEnd - 1] == '?' && itemEnd - itemStart < MAX_TOKEN_LENGTH) {
-            // Check if it's something like "trophy?" with no space
-            int wordLen = itemEnd - itemStart - 1;
-            strncpy(tokens[count], input + itemStart, wordLen);
-            tokens[count][wordLen] = '\0';
-            count++;
-
-            tokens[count][0] = '?';
-            tokens[count][1] = '\0';
-            count++;
-            i = itemEnd; // Update position
-            
-            // Continue parsing after question mark to check for commas or other tokens
-            while (i < inputLen && count < MAX_TOKENS) {
-                while (i < inputLen && isspace(input[i])) i++;
-                if (i >= inputLen) break;
-                
-                // Handle comma or any other character as a separate token
-                if (input[i] == ',') {
-                    tokens[count][0] = ',';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++; 
-                    continue;
-                }
-                
-                // Handle other tokens
-                int tokenStart = i;
-                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                int tokenLen = i - tokenStart;
-                if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                    strncpy(tokens[count], input + tokenStart, tokenLen);
-                    tokens[count][tokenLen] = '\0';
-                    count++;
-                }
-            }
-        } else {
-            int itemLen = itemEnd - itemStart;
-            strncpy(tokens[count], input + itemStart, itemLen);
-            tokens[count][itemLen] = '\0';
-            count++;
-
-            // Add '?' if present
-            while (i < inputLen && input[i] != '?') i++;
-            if (i < inputLen && input[i] == '?') {
-                tokens[count][0] = '?';
-                tokens[count][1] = '\0';
-                count++;
-                i++; 
-                
-                // Continue parsing after question mark to check for commas or other tokens
-                while (i < inputLen && count < MAX_TOKENS) {
-                    // Skip spaces
-                    while (i < inputLen && isspace(input[i])) i++;
-                    if (i >= inputLen) break;
-                    
-                    // Handle comma or any other character as a separate token
-                    if (input[i] == ',') {
-                        tokens[count][0] = ',';
-                        tokens[count][1] = '\0';
-                        count++;
-                        i++; 
-                        continue;
-                    }
-                    
-                    // Handle other tokens
-                    int tokenStart = i;
-                    while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                    int tokenLen = i - tokenStart;
-                    if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                        strncpy(tokens[count], input + tokenStart, tokenLen);
-                        tokens[count][tokenLen] = '\0';
-                        count++;
-                    }
-                }
-            }
+
+        // Check for the exit command
+        if (isExitLine(line, length)) {
+            break;
         }
 
-        return count;
+        // Execute the command and handle result
+        int result = execute_line(line, length);
+        if (result == -1) {
+            writeString("INVALID\n");
+        }
     }
-    // Skip leading whitespace
-    while (i < inputLen && isspace(input[i])) i++;
 
-    // Check for "Geralt"
-    if (i < inputLen && strncmp(input + i, "Geralt", 6) == 0 && 
-        (isspace(input[i+6]) || input[i+6] == '\0')) {
-        strcpy(tokens[0], "Geralt");
-        count = 1;
-        i += 6;
+    if (commandCacheEnabled) {
+        fprintf(stderr, "Command cache: %lu hits, %lu misses\n", commandCacheHits, commandCacheMisses);
+    }
 
-        // Skip whitespace after "Geralt"
-        while (i < inputLen && isspace(input[i])) i++;
+    return 0;
+}
 
-        // Check for "brews" command
-        if (i < inputLen && strncmp(input + i, "brews", 5) == 0 && 
-            (isspace(input[i+5]) || input[i+5] == '\0')) {
-            strcpy(tokens[1], "brews");
-            count = 2;
-            i += 5;
 
-            // Skip whitespace
-            while (i < inputLen && isspace(input[i])) i++;
+/**
+ * @brief Converts a numeric token to an int.
+ *
+ * Reads only the token's own digits, since the line need not be
+ * NUL-terminated. The result matches atoi() on the same digits: the value
+ * saturates at LONG_MAX and is then truncated to int.
+ *
+ * @param text The line the token points into.
+ * @param token The digit run to convert.
+ * @return The value of the token.
+ */
+int tokenToInt(const char* text, TokenSpan token) {
+    const char* p = text + token.start;
+    long value = 0;
+    for (int i = 0; i < token.length; i++) {
+        int digit = p[i] - '0';
+        if (value > (LONG_MAX - digit) / 10) {
+            value = LONG_MAX;
+            break;
+        }
+        value = value * 10 + digit;
+    }
+    return (int)value;
+}
 
-            // Capture potion name
-            int tokenIdx = 0;
-            while (i < inputLen && tokenIdx < MAX_TOKEN_LENGTH - 1) {
-                tokens[2][tokenIdx++] = input[i++];
-            }
-            tokens[2][tokenIdx] = '\0';
+/**
+ * @brief Checks if the given token is a valid positive integer.
+ *
+ * A valid positive integer has no leading zeros (except "0" itself)
+ * and consists only of digit characters.
+ *
+ * @param text The line the token points into.
+ * @param token The token to check.
+ * @return true if the token is a positive integer, false otherwise.
+ */
+bool isPositiveInteger(const char* text, TokenSpan token) {
+    const char* p = text + token.start;
+    if (token.length == 0) return false;
+    
+    // Check for leading zeros (except for a single "0")
+    if (p[0] == '0' && token.length > 1) return false;
+    
+    // Check if all characters are digits
+    for (int i = 0; i < token.length; i++) {
+        if (!isdigit(p[i])) return false;
+    }
+    
+    int value = tokenToInt(text, token);
+    return value > 0;
+}
 
-            if (tokenIdx > 0) {
-                count = 3;
-            }
-            return count;
-        }
-        // Check for "learns" command
-        else if (i < inputLen && strncmp(input + i, "learns", 6) == 0 && 
-        (isspace(input[i+6]) || input[i+6] == '\0')) {
-        strcpy(tokens[1], "learns");
-        count = 2;
-        i += 6;
-
-        // Skip whitespace
-        while (i < inputLen && isspace(input[i])) i++;
-
-        // Store the position after "learns" command to restrict searching to this range
-        int learnsStartPos = i;
-
-        // Peek ahead to find "sign" or "potion"
-        int wordStart = i, wordEnd = i;
-        char tempTokens[MAX_NAME_LENGTH][MAX_TOKEN_LENGTH]; 
-        int tempCount = 0;
-
-        while (i < inputLen && tempCount < MAX_NAME_LENGTH) {
-        while (i < inputLen && isspace(input[i])) i++;
-        if (i >= inputLen) break;
-
-        wordStart = i;
-        while (i < inputLen && !isspace(input[i])) i++;
-        wordEnd = i;
-
-        int wordLen = wordEnd - wordStart;
-        if (wordLen <= 0) break;
-
-        strncpy(tempTokens[tempCount], input + wordStart, wordLen);
-        tempTokens[tempCount][wordLen] = '\0';
-        tempCount++;
-
-        if (strcmp(tempTokens[tempCount - 1], "sign") == 0 ||
-            strcmp(tempTokens[tempCount - 1], "potion") == 0) {
-
-            bool isPotion = strcmp(tempTokens[tempCount - 1], "potion") == 0;
-            const char* type = isPotion ? "potion" : "sign";
-
-            if (tempCount >= 2) {
-                // Find the start of the name by going from learnsStartPos
-                // Instead of using strstr, we'll use the positions we already know
-                int rawStart = learnsStartPos;
-                int rawEnd = wordStart;
-                int nameLen = rawEnd - rawStart;
-
-                while (isspace(input[rawStart]) && nameLen > 0) {
-                    rawStart++;
-                    nameLen--;
-                }
-                while (nameLen > 0 && isspace(input[rawStart + nameLen - 1])) {
-                    nameLen--;
-                }
-
-                if (nameLen <= 0 || nameLen >= MAX_TOKEN_LENGTH) return 0;
-
-                strncpy(tokens[count], input + rawStart, nameLen);
-                tokens[count][nameLen] = '\0';
-                count++;
-
-                strcpy(tokens[count++], type);
-
-                // Check if "is effective against"
-                while (i < inputLen && isspace(input[i])) i++;
-                
-                // Check for "is effective against" 
-                if (i < inputLen && strncmp(input + i, "is", 2) == 0 && 
-                    (isspace(input[i+2]) || input[i+2] == '\0')) {
-                    strcpy(tokens[count++], "is");
-                    i += 2;
-                    
-                    // Skip whitespace
-                    while (i < inputLen && isspace(input[i])) i++;
-                    
-                    // Check for "effective"
-                    if (i < inputLen && strncmp(input + i, "effective", 9) == 0 && 
-                        (isspace(input[i+9]) || input[i+9] == '\0')) {
-                        strcpy(tokens[count++], "effective");
-                        i += 9;
-                        
-                        // Skip whitespace
-                        while (i < inputLen && isspace(input[i])) i++;
-                        
-                        // Check for "against"
-                        if (i < inputLen && strncmp(input + i, "against", 7) == 0 && 
-                            (isspace(input[i+7]) || input[i+7] == '\0')) {
-                            strcpy(tokens[count++], "against");
-                            i += 7;
-                            
-                            // Skip whitespace
-                            while (i < inputLen && isspace(input[i])) i++;
-                            
-                            // Capture monster name
-                            int start = i;
-                            while (i < inputLen) i++;
-                            int len = i - start;
-                            
-                            if (len > 0 && len < MAX_TOKEN_LENGTH) {
-                                strncpy(tokens[count], input + start, len);
-                                tokens[count][len] = '\0';
-                                count++;
-                            }
-                            
-                            return count;
-                        }
-                    }
-                }
-
-                // Check for "consists of"
-                i = wordEnd; // Reset position to after sign/potion
-                while (i < inputLen && isspace(input[i])) i++;
-                
-                if (i < inputLen && strncmp(input + i, "consists", 8) == 0 && 
-                    (isspace(input[i+8]) || input[i+8] == '\0')) {
-                    strcpy(tokens[count++], "consists");
-                    i += 8;
-                    
-                    // Skip whitespace
-                    while (i < inputLen && isspace(input[i])) i++;
-                    
-                    // Check for "of"
-                    if (i < inputLen && strncmp(input + i, "of", 2) == 0 && 
-                        (isspace(input[i+2]) || input[i+2] == '\0')) {
-                        strcpy(tokens[count++], "of");
-                        i += 2;
-                        
-                        // Parse structured ingredient list
-                        while (i < inputLen && count < MAX_TOKENS) {
-                            while (i < inputLen && isspace(input[i])) i++;
-                            if (i >= inputLen) break;
-                            
-                            if (isdigit(input[i])) {
-                                // Handle quantity
-                                int numStart = i;
-                                while (i < inputLen && isdigit(input[i])) i++;
-                                int numLen = i - numStart;
-
-                                if (numLen > 0 && numLen < MAX_TOKEN_LENGTH) {
-                                    strncpy(tokens[count], input + numStart, numLen);
-                                    tokens[count][numLen] = '\0';
-                                    count++;
-                                }
-
-                                // Skip any spaces
-                                while (i < inputLen && isspace(input[i])) i++;
-
-                                // Handle ingredient name
-                                int nameStart = i;
-                                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                                int nameLen = i - nameStart;
-
-                                if (nameLen > 0 && nameLen < MAX_TOKEN_LENGTH) {
-                                    strncpy(tokens[count], input + nameStart, nameLen);
-                                    tokens[count][nameLen] = '\0';
-                                    count++;
-                                }
-
-                                // Skip any spaces
-                                while (i < inputLen && isspace(input[i])) i++;
-
-                                // Handle comma
-                                if (i < inputLen && input[i] == ',') {
-                                    tokens[count][0] = ',';
-                                    tokens[count][1] = '\0';
-                                    count++;
-                                    i++;
-             
-                                }
-                            } else {
-                                // Handle non-digit start
-                                int wordStart = i;
-                                while (i < inputLen && !isspace(input[i]) && input[i] != ',') i++;
-                                int wordLen = i - wordStart;
-                                
-                                if (wordLen > 0 && wordLen < MAX_TOKEN_LENGTH) {
-                                    strncpy(tokens[count], input + wordStart, wordLen);
-                                    tokens[count][wordLen] = '\0';
-                                    count++;
-                                }
-                                
-                                // Skip any spaces
-                                while (i < inputLen && isspace(input[i])) i++;
-                                
-                                // Handle comma if present
-                                if (i < inputLen && input[i] == ',') {
-                                    tokens[count][0] = ',';
-                                    tokens[count][1] = '\0';
-                                    count++;
-                                    i++; // Skip past the comma
-                                    
-                                    // No need to check for spaces after comma
-                                }
-                            }
-                        }
-                        
-                        return count;
-                    }
-                }
-            }
-            return 0;
-        }
-        }
+#define KEYWORD_TABLE_SIZE 64
+
+/**
+ * @brief A slot of the keyword hash table.
+ */
+typedef struct {
+    const char* word;   /**< The keyword, NULL for an empty slot */
+    int length;         /**< Length of the keyword */
+    Terminal terminal;  /**< Terminal the keyword is read as */
+} KeywordEntry;
+
+// Indexed by keywordHash(); the hash is perfect for this set of keywords
+static const KeywordEntry keywordTable[KEYWORD_TABLE_SIZE] = {
+    [0]  = {"sign",        4, TERM_SIGN},
+    [2]  = {"Exit",        4, TERM_EXIT},
+    [6]  = {"ingredient", 10, TERM_INGREDIENT},
+    [12] = {"for",         3, TERM_FOR},
+    [13] = {"encounters", 10, TERM_ENCOUNTERS},
+    [14] = {"Total",       5, TERM_TOTAL},
+    [16] = {"against",     7, TERM_AGAINST},
+    [23] = {"trades",      6, TERM_TRADES},
+    [25] = {"brews",       5, TERM_BREWS},
+    [26] = {"potion",      6, TERM_POTION},
+    [29] = {"trophy",      6, TERM_TROPHY},
+    [34] = {"Geralt",      6, TERM_GERALT},
+    [37] = {"loots",       5, TERM_LOOTS},
+    [39] = {"learns",      6, TERM_LEARNS},
+    [45] = {"consists",    8, TERM_CONSISTS},
+    [48] = {"in",          2, TERM_IN},
+    [49] = {"a",           1, TERM_A},
+    [53] = {"is",          2, TERM_IS},
+    [60] = {"of",          2, TERM_OF},
+    [61] = {"effective",   9, TERM_EFFECTIVE},
+    [62] = {"What",        4, TERM_WHAT},
+};
+
+/**
+ * @brief Hashes a word into the keyword table.
+ *
+ * @param word The first character of the word.
+ * @param length Length of the word, at least 1.
+ * @return A slot index of keywordTable.
+ */
+static unsigned keywordHash(const char* word, int length) {
+    return ((unsigned)length * 2u + (unsigned char)word[0] * 14u
+            + (unsigned char)word[length - 1]) & (KEYWORD_TABLE_SIZE - 1);
+}
+
+/**
+ * @brief Looks up a word in the keyword table.
+ *
+ * @param word The first character of the word.
+ * @param length Length of the word.
+ * @return The keyword's terminal, or TERM_WORD if the word is not a keyword.
+ */
+Terminal lookupKeyword(const char* word, int length) {
+    if (length == 0) return TERM_WORD;
+
+    const KeywordEntry* entry = &keywordTable[keywordHash(word, length)];
+    if (entry->word != NULL && entry->length == length && memcmp(entry->word, word, length) == 0)
+        return entry->terminal;
+    return TERM_WORD;
+}
+
+// States of the command automaton
+typedef enum {
+    STATE_REJECT,
+    STATE_START,
+    STATE_EXIT,
+    STATE_GERALT,
+    STATE_GERALT_WS,
+
+    // Geralt loots <quantity> <ingredient> [, <quantity> <ingredient>]...
+    STATE_LOOTS,
+    STATE_LOOT_QUANTITY,
+    STATE_LOOT_AFTER_QUANTITY,
+    STATE_LOOT_NAME,
+    STATE_LOOT_AFTER_NAME,
+    STATE_LOOT_AFTER_NAME_WS,
+    STATE_LOOT_COMMA,
+
+    // Geralt trades <quantity> <monster> [, ...] trophy for <quantity> <ingredient> [, ...]
+    STATE_TRADES,
+    STATE_TRADE_QUANTITY,
+    STATE_TRADE_AFTER_QUANTITY,
+    STATE_TRADE_NAME,
+    STATE_TRADE_AFTER_NAME,
+    STATE_TRADE_AFTER_NAME_WS,
+    STATE_TRADE_COMMA,
+    STATE_TRADE_TROPHY,
+    STATE_TRADE_TROPHY_WS,
+    STATE_TRADE_FOR,
+    STATE_TRADE_INGREDIENT_QUANTITY,
+    STATE_TRADE_INGREDIENT_AFTER_QUANTITY,
+    STATE_TRADE_INGREDIENT_NAME,
+    STATE_TRADE_INGREDIENT_AFTER_NAME,
+    STATE_TRADE_INGREDIENT_AFTER_NAME_WS,
+    STATE_TRADE_INGREDIENT_COMMA,
+
+    // Geralt brews <potion>
+    STATE_BREWS,
+    STATE_BREW_NAME,
+    STATE_BREW_NAME_WORD,
+    STATE_BREW_NAME_SPACE,
+
+    // Geralt learns <name> sign|potion ...
+    STATE_LEARNS,
+    STATE_LEARN_FIRST,
+    STATE_LEARN_ONE,
+    STATE_LEARN_ONE_SPACE,
+    STATE_LEARN_ONE_BLANK,
+    STATE_LEARN_RESERVED,
+    STATE_LEARN_RESERVED_SPACE,
+    STATE_LEARN_RESERVED_BLANK,
+    STATE_LEARN_MULTI,
+    STATE_LEARN_MULTI_SPACE,
+    STATE_LEARN_MULTI_BLANK,
+    STATE_LEARN_SIGN,
+    STATE_LEARN_SIGN_WS,
+    STATE_LEARN_POTION,
+    STATE_LEARN_POTION_WS,
+    STATE_LEARN_RESERVED_POTION,
+    STATE_LEARN_RESERVED_POTION_WS,
+
+    // ... is effective against <monster>
+    STATE_EFFECT_IS,
+    STATE_EFFECT_IS_WS,
+    STATE_EFFECT_EFFECTIVE,
+    STATE_EFFECT_EFFECTIVE_WS,
+    STATE_EFFECT_AGAINST,
+    STATE_EFFECT_MONSTER,
+    STATE_EFFECT_DONE,
+
+    // ... consists of <quantity> <ingredient> [, <quantity> <ingredient>]...
+    STATE_FORMULA_CONSISTS,
+    STATE_FORMULA_CONSISTS_WS,
+    STATE_FORMULA_OF,
+    STATE_FORMULA_QUANTITY,
+    STATE_FORMULA_AFTER_QUANTITY,
+    STATE_FORMULA_NAME,
+    STATE_FORMULA_AFTER_NAME,
+    STATE_FORMULA_AFTER_NAME_WS,
+    STATE_FORMULA_COMMA,
+
+    // Geralt encounters a <monster>
+    STATE_ENCOUNTERS,
+    STATE_ENCOUNTER_WS,
+    STATE_ENCOUNTER_A,
+    STATE_ENCOUNTER_A_WS,
+    STATE_ENCOUNTER_DONE,
+
+    // Total <category> [<item>] ?
+    STATE_TOTAL,
+    STATE_TOTAL_WS,
+    STATE_TOTAL_CATEGORY,
+    STATE_TOTAL_CATEGORY_WS,
+    STATE_TOTAL_ITEM,
+    STATE_TOTAL_ITEM_WS,
+    STATE_TOTAL_POTION,
+    STATE_TOTAL_POTION_WS,
+    STATE_TOTAL_POTION_NAME,
+    STATE_TOTAL_POTION_NAME_SPACE,
+    STATE_TOTAL_POTION_NAME_BLANK,
+    STATE_TOTAL_ALL_DONE,
+    STATE_TOTAL_SPECIFIC_DONE,
+
+    // What is in <potion> ? / What is effective against <monster> ?
+    STATE_WHAT,
+    STATE_WHAT_WS,
+    STATE_WHAT_IS,
+    STATE_WHAT_IS_WS,
+    STATE_WHAT_IN,
+    STATE_ALCHEMY_NAME,
+    STATE_ALCHEMY_NAME_WORD,
+    STATE_ALCHEMY_NAME_SPACE,
+    STATE_ALCHEMY_NAME_BLANK,
+    STATE_ALCHEMY_DONE,
+    STATE_WHAT_EFFECTIVE,
+    STATE_WHAT_EFFECTIVE_WS,
+    STATE_WHAT_AGAINST,
+    STATE_BESTIARY_NAME,
+    STATE_BESTIARY_MONSTER,
+    STATE_BESTIARY_MONSTER_WS,
+    STATE_BESTIARY_DONE,
+
+    STATE_COUNT
+} GrammarState;
+
+// What a transition records in the command
+typedef enum {
+    PARSE_NONE,
+    PARSE_QUANTITY,             // Quantity of the next entry
+    PARSE_ITEM,                 // Name of the entry, completing it
+    PARSE_TRADE_SPLIT,          // End of the trophies of a trade
+    PARSE_SUBJECT,              // First word of the subject
+    PARSE_EXTEND_SUBJECT,       // Further word of a multi-word subject
+    PARSE_TARGET,               // Monster of an effectiveness statement
+    PARSE_SIGN,                 // The counter is a sign
+    PARSE_INGREDIENT_CATEGORY,
+    PARSE_POTION_CATEGORY,
+    PARSE_TROPHY_CATEGORY
+} ParseAction;
+
+// Terminal classes usable in rules besides the terminals themselves
+enum {
+    RULE_WHITESPACE = TERM_COUNT,   // TERM_SPACE or TERM_BLANK
+    RULE_NAME                       // TERM_WORD or any keyword
+};
+
+/**
+ * @brief A transition of the command grammar.
+ */
+typedef struct {
+    GrammarState from;      /**< State the rule applies in */
+    int terminal;           /**< Terminal or RULE_ class read */
+    GrammarState to;        /**< State after reading it */
+    ParseAction action;     /**< What to record in the command */
+} GrammarRule;
+
+/**
+ * @brief The whole command grammar.
+ *
+ * RULE_NAME rules accept keywords too, so keywords can be used as names.
+ * A rule for a specific keyword takes precedence over the RULE_NAME rule of
+ * the same state; a rule leading to STATE_REJECT excludes that keyword.
+ * Every pair missing from the table rejects the line.
+ */
+static const GrammarRule grammarRules[] = {
+    {STATE_START, TERM_GERALT, STATE_GERALT, PARSE_NONE},
+    {STATE_START, TERM_TOTAL, STATE_TOTAL, PARSE_NONE},
+    {STATE_START, TERM_WHAT, STATE_WHAT, PARSE_NONE},
+    {STATE_START, TERM_EXIT, STATE_EXIT, PARSE_NONE},
+    {STATE_GERALT, RULE_WHITESPACE, STATE_GERALT_WS, PARSE_NONE},
+    {STATE_GERALT_WS, TERM_LOOTS, STATE_LOOTS, PARSE_NONE},
+    {STATE_GERALT_WS, TERM_TRADES, STATE_TRADES, PARSE_NONE},
+    {STATE_GERALT_WS, TERM_BREWS, STATE_BREWS, PARSE_NONE},
+    {STATE_GERALT_WS, TERM_LEARNS, STATE_LEARNS, PARSE_NONE},
+    {STATE_GERALT_WS, TERM_ENCOUNTERS, STATE_ENCOUNTERS, PARSE_NONE},
+
+    // Loot list; commas may be surrounded by any whitespace
+    {STATE_LOOTS, RULE_WHITESPACE, STATE_LOOT_QUANTITY, PARSE_NONE},
+    {STATE_LOOT_QUANTITY, TERM_NUMBER, STATE_LOOT_AFTER_QUANTITY, PARSE_QUANTITY},
+    {STATE_LOOT_AFTER_QUANTITY, RULE_WHITESPACE, STATE_LOOT_NAME, PARSE_NONE},
+    {STATE_LOOT_NAME, RULE_NAME, STATE_LOOT_AFTER_NAME, PARSE_ITEM},
+    {STATE_LOOT_AFTER_NAME, RULE_WHITESPACE, STATE_LOOT_AFTER_NAME_WS, PARSE_NONE},
+    {STATE_LOOT_AFTER_NAME, TERM_COMMA, STATE_LOOT_COMMA, PARSE_NONE},
+    {STATE_LOOT_AFTER_NAME_WS, TERM_COMMA, STATE_LOOT_COMMA, PARSE_NONE},
+    {STATE_LOOT_COMMA, RULE_WHITESPACE, STATE_LOOT_QUANTITY, PARSE_NONE},
+    {STATE_LOOT_COMMA, TERM_NUMBER, STATE_LOOT_AFTER_QUANTITY, PARSE_QUANTITY},
+
+    // Trophy list; a trophy cannot be named "for" and the last one is followed by "trophy for"
+    {STATE_TRADES, RULE_WHITESPACE, STATE_TRADE_QUANTITY, PARSE_NONE},
+    {STATE_TRADE_QUANTITY, TERM_NUMBER, STATE_TRADE_AFTER_QUANTITY, PARSE_QUANTITY},
+    {STATE_TRADE_AFTER_QUANTITY, RULE_WHITESPACE, STATE_TRADE_NAME, PARSE_NONE},
+    {STATE_TRADE_NAME, RULE_NAME, STATE_TRADE_AFTER_NAME, PARSE_ITEM},
+    {STATE_TRADE_NAME, TERM_FOR, STATE_REJECT, PARSE_NONE},
+    {STATE_TRADE_AFTER_NAME, RULE_WHITESPACE, STATE_TRADE_AFTER_NAME_WS, PARSE_NONE},
+    {STATE_TRADE_AFTER_NAME, TERM_COMMA, STATE_TRADE_COMMA, PARSE_NONE},
+    {STATE_TRADE_AFTER_NAME_WS, TERM_COMMA, STATE_TRADE_COMMA, PARSE_NONE},
+    {STATE_TRADE_AFTER_NAME_WS, TERM_TROPHY, STATE_TRADE_TROPHY, PARSE_NONE},
+    {STATE_TRADE_COMMA, RULE_WHITESPACE, STATE_TRADE_QUANTITY, PARSE_NONE},
+    {STATE_TRADE_COMMA, TERM_NUMBER, STATE_TRADE_AFTER_QUANTITY, PARSE_QUANTITY},
+    {STATE_TRADE_TROPHY, RULE_WHITESPACE, STATE_TRADE_TROPHY_WS, PARSE_NONE},
+    {STATE_TRADE_TROPHY_WS, TERM_FOR, STATE_TRADE_FOR, PARSE_TRADE_SPLIT},
+
+    // Ingredient list of a trade
+    {STATE_TRADE_FOR, RULE_WHITESPACE, STATE_TRADE_INGREDIENT_QUANTITY, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_QUANTITY, TERM_NUMBER, STATE_TRADE_INGREDIENT_AFTER_QUANTITY, PARSE_QUANTITY},
+    {STATE_TRADE_INGREDIENT_AFTER_QUANTITY, RULE_WHITESPACE, STATE_TRADE_INGREDIENT_NAME, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_NAME, RULE_NAME, STATE_TRADE_INGREDIENT_AFTER_NAME, PARSE_ITEM},
+    {STATE_TRADE_INGREDIENT_AFTER_NAME, RULE_WHITESPACE, STATE_TRADE_INGREDIENT_AFTER_NAME_WS, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_AFTER_NAME, TERM_COMMA, STATE_TRADE_INGREDIENT_COMMA, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_AFTER_NAME_WS, TERM_COMMA, STATE_TRADE_INGREDIENT_COMMA, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_COMMA, RULE_WHITESPACE, STATE_TRADE_INGREDIENT_QUANTITY, PARSE_NONE},
+    {STATE_TRADE_INGREDIENT_COMMA, TERM_NUMBER, STATE_TRADE_INGREDIENT_AFTER_QUANTITY, PARSE_QUANTITY},
+
+    // Potion name: letter words separated by single spaces
+    {STATE_BREWS, RULE_WHITESPACE, STATE_BREW_NAME, PARSE_NONE},
+    {STATE_BREW_NAME, RULE_NAME, STATE_BREW_NAME_WORD, PARSE_SUBJECT},
+    {STATE_BREW_NAME_WORD, TERM_SPACE, STATE_BREW_NAME_SPACE, PARSE_NONE},
+    {STATE_BREW_NAME_SPACE, RULE_NAME, STATE_BREW_NAME_WORD, PARSE_EXTEND_SUBJECT},
+
+    // The name ends at the first "sign" or "potion" and cannot start with
+    // either. A sign name is a single word; "consists" and "of" alone cannot
+    // name a potion with a formula.
+    {STATE_LEARNS, RULE_WHITESPACE, STATE_LEARN_FIRST, PARSE_NONE},
+    {STATE_LEARN_FIRST, RULE_NAME, STATE_LEARN_ONE, PARSE_SUBJECT},
+    {STATE_LEARN_FIRST, TERM_SIGN, STATE_REJECT, PARSE_NONE},
+    {STATE_LEARN_FIRST, TERM_POTION, STATE_REJECT, PARSE_NONE},
+    {STATE_LEARN_FIRST, TERM_CONSISTS, STATE_LEARN_RESERVED, PARSE_SUBJECT},
+    {STATE_LEARN_FIRST, TERM_OF, STATE_LEARN_RESERVED, PARSE_SUBJECT},
+    {STATE_LEARN_ONE, TERM_SPACE, STATE_LEARN_ONE_SPACE, PARSE_NONE},
+    {STATE_LEARN_ONE, TERM_BLANK, STATE_LEARN_ONE_BLANK, PARSE_NONE},
+    {STATE_LEARN_ONE_SPACE, RULE_NAME, STATE_LEARN_MULTI, PARSE_EXTEND_SUBJECT},
+    {STATE_LEARN_ONE_SPACE, TERM_SIGN, STATE_LEARN_SIGN, PARSE_SIGN},
+    {STATE_LEARN_ONE_SPACE, TERM_POTION, STATE_LEARN_POTION, PARSE_NONE},
+    {STATE_LEARN_ONE_BLANK, TERM_SIGN, STATE_LEARN_SIGN, PARSE_SIGN},
+    {STATE_LEARN_ONE_BLANK, TERM_POTION, STATE_LEARN_POTION, PARSE_NONE},
+    {STATE_LEARN_RESERVED, TERM_SPACE, STATE_LEARN_RESERVED_SPACE, PARSE_NONE},
+    {STATE_LEARN_RESERVED, TERM_BLANK, STATE_LEARN_RESERVED_BLANK, PARSE_NONE},
+    {STATE_LEARN_RESERVED_SPACE, RULE_NAME, STATE_LEARN_MULTI, PARSE_EXTEND_SUBJECT},
+    {STATE_LEARN_RESERVED_SPACE, TERM_SIGN, STATE_LEARN_SIGN, PARSE_SIGN},
+    {STATE_LEARN_RESERVED_SPACE, TERM_POTION, STATE_LEARN_RESERVED_POTION, PARSE_NONE},
+    {STATE_LEARN_RESERVED_BLANK, TERM_SIGN, STATE_LEARN_SIGN, PARSE_SIGN},
+    {STATE_LEARN_RESERVED_BLANK, TERM_POTION, STATE_LEARN_RESERVED_POTION, PARSE_NONE},
+    {STATE_LEARN_MULTI, TERM_SPACE, STATE_LEARN_MULTI_SPACE, PARSE_NONE},
+    {STATE_LEARN_MULTI, TERM_BLANK, STATE_LEARN_MULTI_BLANK, PARSE_NONE},
+    {STATE_LEARN_MULTI_SPACE, RULE_NAME, STATE_LEARN_MULTI, PARSE_EXTEND_SUBJECT},
+    {STATE_LEARN_MULTI_SPACE, TERM_SIGN, STATE_REJECT, PARSE_NONE},
+    {STATE_LEARN_MULTI_SPACE, TERM_POTION, STATE_LEARN_POTION, PARSE_NONE},
+    {STATE_LEARN_MULTI_BLANK, TERM_POTION, STATE_LEARN_POTION, PARSE_NONE},
+    {STATE_LEARN_SIGN, RULE_WHITESPACE, STATE_LEARN_SIGN_WS, PARSE_NONE},
+    {STATE_LEARN_SIGN_WS, TERM_IS, STATE_EFFECT_IS, PARSE_NONE},
+    {STATE_LEARN_POTION, RULE_WHITESPACE, STATE_LEARN_POTION_WS, PARSE_NONE},
+    {STATE_LEARN_POTION_WS, TERM_IS, STATE_EFFECT_IS, PARSE_NONE},
+    {STATE_LEARN_POTION_WS, TERM_CONSISTS, STATE_FORMULA_CONSISTS, PARSE_NONE},
+    {STATE_LEARN_RESERVED_POTION, RULE_WHITESPACE, STATE_LEARN_RESERVED_POTION_WS, PARSE_NONE},
+    {STATE_LEARN_RESERVED_POTION_WS, TERM_IS, STATE_EFFECT_IS, PARSE_NONE},
+
+    {STATE_EFFECT_IS, RULE_WHITESPACE, STATE_EFFECT_IS_WS, PARSE_NONE},
+    {STATE_EFFECT_IS_WS, TERM_EFFECTIVE, STATE_EFFECT_EFFECTIVE, PARSE_NONE},
+    {STATE_EFFECT_EFFECTIVE, RULE_WHITESPACE, STATE_EFFECT_EFFECTIVE_WS, PARSE_NONE},
+    {STATE_EFFECT_EFFECTIVE_WS, TERM_AGAINST, STATE_EFFECT_AGAINST, PARSE_NONE},
+    {STATE_EFFECT_AGAINST, RULE_WHITESPACE, STATE_EFFECT_MONSTER, PARSE_NONE},
+    {STATE_EFFECT_MONSTER, RULE_NAME, STATE_EFFECT_DONE, PARSE_TARGET},
+
+    // Formula list; a quantity may be glued to its ingredient ("3Rebis")
+    {STATE_FORMULA_CONSISTS, RULE_WHITESPACE, STATE_FORMULA_CONSISTS_WS, PARSE_NONE},
+    {STATE_FORMULA_CONSISTS_WS, TERM_OF, STATE_FORMULA_OF, PARSE_NONE},
+    {STATE_FORMULA_OF, RULE_WHITESPACE, STATE_FORMULA_QUANTITY, PARSE_NONE},
+    {STATE_FORMULA_QUANTITY, TERM_NUMBER, STATE_FORMULA_AFTER_QUANTITY, PARSE_QUANTITY},
+    {STATE_FORMULA_AFTER_QUANTITY, RULE_WHITESPACE, STATE_FORMULA_NAME, PARSE_NONE},
+    {STATE_FORMULA_AFTER_QUANTITY, RULE_NAME, STATE_FORMULA_AFTER_NAME, PARSE_ITEM},
+    {STATE_FORMULA_NAME, RULE_NAME, STATE_FORMULA_AFTER_NAME, PARSE_ITEM},
+    {STATE_FORMULA_AFTER_NAME, RULE_WHITESPACE, STATE_FORMULA_AFTER_NAME_WS, PARSE_NONE},
+    {STATE_FORMULA_AFTER_NAME, TERM_COMMA, STATE_FORMULA_COMMA, PARSE_NONE},
+    {STATE_FORMULA_AFTER_NAME_WS, TERM_COMMA, STATE_FORMULA_COMMA, PARSE_NONE},
+    {STATE_FORMULA_COMMA, RULE_WHITESPACE, STATE_FORMULA_QUANTITY, PARSE_NONE},
+    {STATE_FORMULA_COMMA, TERM_NUMBER, STATE_FORMULA_AFTER_QUANTITY, PARSE_QUANTITY},
+
+    {STATE_ENCOUNTERS, RULE_WHITESPACE, STATE_ENCOUNTER_WS, PARSE_NONE},
+    {STATE_ENCOUNTER_WS, TERM_A, STATE_ENCOUNTER_A, PARSE_NONE},
+    {STATE_ENCOUNTER_A, RULE_WHITESPACE, STATE_ENCOUNTER_A_WS, PARSE_NONE},
+    {STATE_ENCOUNTER_A_WS, RULE_NAME, STATE_ENCOUNTER_DONE, PARSE_SUBJECT},
+
+    // '?' may be attached to the category or the item
+    {STATE_TOTAL, RULE_WHITESPACE, STATE_TOTAL_WS, PARSE_NONE},
+    {STATE_TOTAL_WS, TERM_INGREDIENT, STATE_TOTAL_CATEGORY, PARSE_INGREDIENT_CATEGORY},
+    {STATE_TOTAL_WS, TERM_TROPHY, STATE_TOTAL_CATEGORY, PARSE_TROPHY_CATEGORY},
+    {STATE_TOTAL_WS, TERM_POTION, STATE_TOTAL_POTION, PARSE_POTION_CATEGORY},
+    {STATE_TOTAL_CATEGORY, TERM_QUESTION, STATE_TOTAL_ALL_DONE, PARSE_NONE},
+    {STATE_TOTAL_CATEGORY, RULE_WHITESPACE, STATE_TOTAL_CATEGORY_WS, PARSE_NONE},
+    {STATE_TOTAL_CATEGORY_WS, TERM_QUESTION, STATE_TOTAL_ALL_DONE, PARSE_NONE},
+    {STATE_TOTAL_CATEGORY_WS, RULE_NAME, STATE_TOTAL_ITEM, PARSE_SUBJECT},
+    {STATE_TOTAL_ITEM, RULE_WHITESPACE, STATE_TOTAL_ITEM_WS, PARSE_NONE},
+    {STATE_TOTAL_ITEM, TERM_QUESTION, STATE_TOTAL_SPECIFIC_DONE, PARSE_NONE},
+    {STATE_TOTAL_ITEM_WS, TERM_QUESTION, STATE_TOTAL_SPECIFIC_DONE, PARSE_NONE},
+    {STATE_TOTAL_POTION, TERM_QUESTION, STATE_TOTAL_ALL_DONE, PARSE_NONE},
+    {STATE_TOTAL_POTION, RULE_WHITESPACE, STATE_TOTAL_POTION_WS, PARSE_NONE},
+    {STATE_TOTAL_POTION_WS, TERM_QUESTION, STATE_TOTAL_ALL_DONE, PARSE_NONE},
+    {STATE_TOTAL_POTION_WS, RULE_NAME, STATE_TOTAL_POTION_NAME, PARSE_SUBJECT},
+    {STATE_TOTAL_POTION_NAME, TERM_SPACE, STATE_TOTAL_POTION_NAME_SPACE, PARSE_NONE},
+    {STATE_TOTAL_POTION_NAME, TERM_BLANK, STATE_TOTAL_POTION_NAME_BLANK, PARSE_NONE},
+    {STATE_TOTAL_POTION_NAME, TERM_QUESTION, STATE_TOTAL_SPECIFIC_DONE, PARSE_NONE},
+    {STATE_TOTAL_POTION_NAME_SPACE, RULE_NAME, STATE_TOTAL_POTION_NAME, PARSE_EXTEND_SUBJECT},
+    {STATE_TOTAL_POTION_NAME_SPACE, TERM_QUESTION, STATE_TOTAL_SPECIFIC_DONE, PARSE_NONE},
+    {STATE_TOTAL_POTION_NAME_BLANK, TERM_QUESTION, STATE_TOTAL_SPECIFIC_DONE, PARSE_NONE},
+
+    {STATE_WHAT, RULE_WHITESPACE, STATE_WHAT_WS, PARSE_NONE},
+    {STATE_WHAT_WS, TERM_IS, STATE_WHAT_IS, PARSE_NONE},
+    {STATE_WHAT_IS, RULE_WHITESPACE, STATE_WHAT_IS_WS, PARSE_NONE},
+    {STATE_WHAT_IS_WS, TERM_IN, STATE_WHAT_IN, PARSE_NONE},
+    {STATE_WHAT_IS_WS, TERM_EFFECTIVE, STATE_WHAT_EFFECTIVE, PARSE_NONE},
+    {STATE_WHAT_IN, RULE_WHITESPACE, STATE_ALCHEMY_NAME, PARSE_NONE},
+    {STATE_ALCHEMY_NAME, RULE_NAME, STATE_ALCHEMY_NAME_WORD, PARSE_SUBJECT},
+    {STATE_ALCHEMY_NAME_WORD, TERM_SPACE, STATE_ALCHEMY_NAME_SPACE, PARSE_NONE},
+    {STATE_ALCHEMY_NAME_WORD, TERM_BLANK, STATE_ALCHEMY_NAME_BLANK, PARSE_NONE},
+    {STATE_ALCHEMY_NAME_WORD, TERM_QUESTION, STATE_ALCHEMY_DONE, PARSE_NONE},
+    {STATE_ALCHEMY_NAME_SPACE, RULE_NAME, STATE_ALCHEMY_NAME_WORD, PARSE_EXTEND_SUBJECT},
+    {STATE_ALCHEMY_NAME_SPACE, TERM_QUESTION, STATE_ALCHEMY_DONE, PARSE_NONE},
+    {STATE_ALCHEMY_NAME_BLANK, TERM_QUESTION, STATE_ALCHEMY_DONE, PARSE_NONE},
+    {STATE_WHAT_EFFECTIVE, RULE_WHITESPACE, STATE_WHAT_EFFECTIVE_WS, PARSE_NONE},
+    {STATE_WHAT_EFFECTIVE_WS, TERM_AGAINST, STATE_WHAT_AGAINST, PARSE_NONE},
+    {STATE_WHAT_AGAINST, RULE_WHITESPACE, STATE_BESTIARY_NAME, PARSE_NONE},
+    {STATE_BESTIARY_NAME, RULE_NAME, STATE_BESTIARY_MONSTER, PARSE_SUBJECT},
+    {STATE_BESTIARY_MONSTER, RULE_WHITESPACE, STATE_BESTIARY_MONSTER_WS, PARSE_NONE},
+    {STATE_BESTIARY_MONSTER, TERM_QUESTION, STATE_BESTIARY_DONE, PARSE_NONE},
+    {STATE_BESTIARY_MONSTER_WS, TERM_QUESTION, STATE_BESTIARY_DONE, PARSE_NONE},
+};
+
+/**
+ * @brief A state in which the line may end, and the command it then is.
+ */
+typedef struct {
+    GrammarState state;     /**< Final state */
+    CommandType type;       /**< Command recognized when the line ends here */
+} GrammarAccept;
+
+static const GrammarAccept grammarAccepts[] = {
+    {STATE_EXIT, EXIT_COMMAND},
+    {STATE_LOOT_AFTER_NAME, ACTION_LOOT},
+    {STATE_TRADE_INGREDIENT_AFTER_NAME, ACTION_TRADE},
+    {STATE_BREW_NAME_WORD, ACTION_BREW},
+    {STATE_EFFECT_DONE, KNOWLEDGE_EFFECTIVENESS},
+    {STATE_FORMULA_AFTER_NAME, KNOWLEDGE_POTION_FORMULA},
+    {STATE_ENCOUNTER_DONE, ENCOUNTER},
+    {STATE_TOTAL_ALL_DONE, QUERY_ALL_INVENTORY},
+    {STATE_TOTAL_SPECIFIC_DONE, QUERY_SPECIFIC_INVENTORY},
+    {STATE_ALCHEMY_DONE, QUERY_ALCHEMY},
+    {STATE_BESTIARY_DONE, QUERY_BESTIARY},
+};
+
+// Character classes of the lexer
+enum {
+    CHAR_END,
+    CHAR_SPACE,
+    CHAR_LETTER,
+    CHAR_DIGIT,
+    CHAR_COMMA,
+    CHAR_QUESTION,
+    CHAR_OTHER
+};
+
+static unsigned char charClass[256];
+static unsigned char grammarNext[STATE_COUNT][TERM_COUNT];
+static unsigned char grammarAction[STATE_COUNT][TERM_COUNT];
+static CommandType grammarAccept[STATE_COUNT];
+
+/**
+ * @brief Sets the transition of a state on a rule's terminal or terminal class.
+ *
+ * @param rule The rule to apply.
+ */
+static void setGrammarTransition(const GrammarRule* rule) {
+    int first = rule->terminal, last = rule->terminal;
+
+    if (rule->terminal == RULE_WHITESPACE) {
+        first = TERM_SPACE;
+        last = TERM_BLANK;
+    } else if (rule->terminal == RULE_NAME) {
+        first = TERM_WORD;
+        last = TERM_COUNT - 1;
+    }
+
+    for (int t = first; t <= last; t++) {
+        grammarNext[rule->from][t] = rule->to;
+        grammarAction[rule->from][t] = rule->action;
+    }
+}
+
+/**
+ * @brief Compiles the grammar rules into the transition tables.
+ *
+ * Must be called once before any line is parsed.
+ */
+void compileGrammar(void) {
+    for (int c = 0; c < 256; c++) {
+        if (c == '\0') charClass[c] = CHAR_END;
+        else if (isspace(c)) charClass[c] = CHAR_SPACE;
+        else if (isalpha(c)) charClass[c] = CHAR_LETTER;
+        else if (isdigit(c)) charClass[c] = CHAR_DIGIT;
+        else if (c == ',') charClass[c] = CHAR_COMMA;
+        else if (c == '?') charClass[c] = CHAR_QUESTION;
+        else charClass[c] = CHAR_OTHER;
+    }
+
+    int ruleCount = sizeof(grammarRules) / sizeof(grammarRules[0]);
+
+    // Class rules first, so that rules for single terminals override them
+    for (int i = 0; i < ruleCount; i++) {
+        if (grammarRules[i].terminal >= TERM_COUNT)
+            setGrammarTransition(&grammarRules[i]);
+    }
+    for (int i = 0; i < ruleCount; i++) {
+        if (grammarRules[i].terminal < TERM_COUNT)
+            setGrammarTransition(&grammarRules[i]);
+    }
+
+    for (int i = 0; i < (int)(sizeof(grammarAccepts) / sizeof(grammarAccepts[0])); i++) {
+        grammarAccept[grammarAccepts[i].state] = grammarAccepts[i].type;
+    }
+}
+
+/**
+ * @brief Computes the character class masks of SCAN_WINDOW bytes.
+ *
+ * Uses AVX2 or SSE2 compares when the target has them, and the charClass
+ * table otherwise. The classes match isspace(), isalpha() and isdigit() in
+ * the C locale.
+ *
+ * @param p The bytes to classify.
+ * @param window Receives the masks.
+ */
+static void classifyWindow(const unsigned char* p, ScanWindow* window) {
+    window->space = 0;
+    window->letter = 0;
+    window->digit = 0;
+
+#if defined(__AVX2__)
+    for (int k = 0; k < SCAN_WINDOW; k += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(p + k));
+        __m256i lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+        __m256i space = _mm256_or_si256(
+            _mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+            _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('\t' - 1)),
+                             _mm256_cmpgt_epi8(_mm256_set1_epi8('\r' + 1), v)));
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)),
+                                          _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('0' - 1)),
+                                         _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), v));
+        window->space |= (uint64_t)(uint32_t)_mm256_movemask_epi8(space) << k;
+        window->letter |= (uint64_t)(uint32_t)_mm256_movemask_epi8(letter) << k;
+        window->digit |= (uint64_t)(uint32_t)_mm256_movemask_epi8(digit) << k;
+    }
+#elif defined(__SSE2__)
+    for (int k = 0; k < SCAN_WINDOW; k += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(p + k));
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i space = _mm_or_si128(
+            _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+            _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('\t' - 1)),
+                          _mm_cmplt_epi8(v, _mm_set1_epi8('\r' + 1))));
+        __m128i letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                       _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        window->space |= (uint64_t)(uint16_t)_mm_movemask_epi8(space) << k;
+        window->letter |= (uint64_t)(uint16_t)_mm_movemask_epi8(letter) << k;
+        window->digit |= (uint64_t)(uint16_t)_mm_movemask_epi8(digit) << k;
+    }
+#else
+    for (int k = 0; k < SCAN_WINDOW; k++) {
+        uint64_t bit = (uint64_t)1 << k;
+        switch (charClass[p[k]]) {
+            case CHAR_SPACE: window->space |= bit; break;
+            case CHAR_LETTER: window->letter |= bit; break;
+            case CHAR_DIGIT: window->digit |= bit; break;
+        }
+    }
+#endif
+}
+
+/**
+ * @brief Moves the scanner's window to start at the given offset.
+ *
+ * @param scanner The scanner.
+ * @param base Offset of the new window, at most the length of the line.
+ */
+static void loadScanWindow(Scanner* scanner, int base) {
+    unsigned char padded[SCAN_WINDOW];
+    const unsigned char* p = (const unsigned char*)scanner->text + base;
+    int rest = scanner->length - base;
+
+    // Never read past the end of the line: classify a zero-padded copy instead
+    if (rest < SCAN_WINDOW) {
+        memcpy(padded, p, rest);
+        memset(padded + rest, 0, SCAN_WINDOW - rest);
+        p = padded;
+    }
 
-        return 0; // fallback if neither potion nor sign
+    scanner->window.base = base;
+    classifyWindow(p, &scanner->window);
+}
+
+/**
+ * @brief Finds the end of a run of whitespace, letters or digits using the
+ *        scanner's window masks.
+ *
+ * @param scanner The scanner.
+ * @param i Offset of the first character of the run.
+ * @param charType CHAR_SPACE, CHAR_LETTER or CHAR_DIGIT.
+ * @return Offset of the first character after the run.
+ */
+static int scanWindowRunEnd(Scanner* scanner, int i, int charType) {
+    while (1) {
+        int offset = i - scanner->window.base;
+        if (offset < 0 || offset >= SCAN_WINDOW) {
+            loadScanWindow(scanner, i);
+            offset = 0;
         }
-        // Check for "trades" command 
-        else if (i < inputLen && strncmp(input + i, "trades", 6) == 0 && 
-                (isspace(input[i+6]) || input[i+6] == '\0')) {
-            strcpy(tokens[1], "trades");
-            count = 2;
-            i += 6;
-            
-            // Process the rest as generic tokens, making sure to handle commas properly
-            while (i < inputLen && count < MAX_TOKENS) {
-                // Skip spaces
-                while (i < inputLen && isspace(input[i])) i++;
-                if (i >= inputLen) break;
-                
-                // Handle comma as separate token
-                if (input[i] == ',') {
-                    tokens[count][0] = ',';
-                    tokens[count][1] = '\0';
-                    count++;
-                    i++; // Skip past comma
-                    continue;
-                }
-                
-                // Handle regular token
-                int tokenStart = i;
-                while (i < inputLen && input[i] != ',' && !isspace(input[i])) i++;
-                
-                int tokenLen = i - tokenStart;
-                if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-                    strncpy(tokens[count], input + tokenStart, tokenLen);
-                    tokens[count][tokenLen] = '\0';
-                    count++;
-                }
-            }
-            
-            return count;
+
+        uint64_t mask = charType == CHAR_SPACE ? scanner->window.space
+                      : charType == CHAR_LETTER ? scanner->window.letter
+                      : scanner->window.digit;
+
+        // The first clear bit ends the run, unless it lies past the window
+        uint64_t stop = ~(mask >> offset);
+        if (stop != 0) {
+            int run = __builtin_ctzll(stop);
+            if (run < SCAN_WINDOW - offset)
+                return i + run;
         }
+        i = scanner->window.base + SCAN_WINDOW;
+    }
+}
+
+/**
+ * @brief Finds the end of a run of whitespace, letters or digits.
+ *
+ * @param scanner The scanner.
+ * @param i Offset of the first character of the run.
+ * @param charType CHAR_SPACE, CHAR_LETTER or CHAR_DIGIT.
+ * @return Offset of the first character after the run.
+ */
+static inline int scanRunEnd(Scanner* scanner, int i, int charType) {
+    // Lines shorter than a window are cheaper to scan byte by byte
+    if (scanner->length < SCAN_WINDOW) {
+        while (i < scanner->length && charClass[(unsigned char)scanner->text[i]] == charType) i++;
+        return i;
+    }
+    return scanWindowRunEnd(scanner, i, charType);
+}
+
+/**
+ * @brief Reads the next terminal of the line.
+ *
+ * Whitespace, letters and digits are read as whole runs; commas, question
+ * marks and any other character are read one at a time.
+ *
+ * @param scanner The scanner; advanced past the terminal.
+ * @param lexeme Set to the span of the terminal.
+ * @return The terminal read, TERM_END at the end of the line.
+ */
+static inline Terminal nextTerminal(Scanner* scanner, TokenSpan* lexeme) {
+    const char* text = scanner->text;
+    int start = scanner->pos;
+    int i = start;
+    // The line need not be NUL-terminated; its end is known from its length
+    int charType = i < scanner->length ? charClass[(unsigned char)text[i]] : CHAR_END;
+    Terminal terminal;
+
+    switch (charType) {
+        case CHAR_END:
+            terminal = TERM_END;
+            break;
+        case CHAR_SPACE:
+            i = scanRunEnd(scanner, i, CHAR_SPACE);
+            terminal = (i - start == 1 && text[start] == ' ') ? TERM_SPACE : TERM_BLANK;
+            break;
+        case CHAR_LETTER:
+            i = scanRunEnd(scanner, i, CHAR_LETTER);
+            terminal = lookupKeyword(text + start, i - start);
+            break;
+        case CHAR_DIGIT:
+            i = scanRunEnd(scanner, i, CHAR_DIGIT);
+            terminal = TERM_NUMBER;
+            break;
+        case CHAR_COMMA:
+            i++;
+            terminal = TERM_COMMA;
+            break;
+        case CHAR_QUESTION:
+            i++;
+            terminal = TERM_QUESTION;
+            break;
+        default:
+            i++;
+            terminal = TERM_OTHER;
+            break;
     }
 
-    // Generic fallback
-    // Reset index since we may have partially matched above
-    i = 0;
-    count = 0;
-    
-    while (i < inputLen && count < MAX_TOKENS) {
-        // Skip spaces
-        while (i < inputLen && isspace(input[i])) i++;
-        if (i >= inputLen) break;
+    *lexeme = (TokenSpan){start, i - start};
+    scanner->pos = i;
+    return terminal;
+}
+
+/**
+ * @brief Parses a line into a command in one pass over the grammar automaton.
+ *
+ * The line is read terminal by terminal; each one selects the next state and
+ * what to record in the command (entry quantities and names, subject, target,
+ * category). The line is rejected as soon as no transition matches, and is a
+ * command if it ends in a final state.
+ *
+ * @param input The cleaned input line; it need not be NUL-terminated.
+ * @param length Length of the line.
+ * @param cmd The command record to fill in.
+ * @return true if the line is a valid command, false otherwise.
+ */
+bool parseCommand(const char* input, int length, Command* cmd) {
+    cmd->text = input;
+    cmd->type = INVALID_COMMAND;
+    cmd->counterIsSign = false;
+    cmd->itemCount = 0;
+    cmd->tradeSplit = 0;
+    reserveItems(cmd, 0);
+
+    // The first window is loaded by the first run that needs it
+    Scanner scanner = {input, length, 0, {-SCAN_WINDOW, 0, 0, 0}};
+
+    int state = STATE_START;
+
+    while (1) {
+        TokenSpan lexeme;
+        Terminal terminal = nextTerminal(&scanner, &lexeme);
 
-        // Handle comma as separate token
-        if (input[i] == ',') {
-            tokens[count][0] = ',';
-            tokens[count][1] = '\0';
-            count++;
-            i++; // Skip past comma
-            continue; // Continue to next token without checking for spaces
+        if (terminal == TERM_END) {
+            cmd->type = grammarAccept[state];
+            return cmd->type != INVALID_COMMAND;
         }
 
-        // Handle regular token
-        int tokenStart = i;
-        while (i < inputLen && input[i] != ',' && !isspace(input[i])) i++;
+        int next = grammarNext[state][terminal];
+        if (next == STATE_REJECT)
+            return false;
 
-        int tokenLen = i - tokenStart;
-        if (tokenLen > 0 && tokenLen < MAX_TOKEN_LENGTH) {
-            strncpy(tokens[count], input + tokenStart, tokenLen);
-            tokens[count][tokenLen] = '\0';
-            count++;
+        switch (grammarAction[state][terminal]) {
+            case PARSE_QUANTITY:
+                if (!isPositiveInteger(input, lexeme))
+                    return false;
+                reserveItems(cmd, cmd->itemCount + 1);
+                cmd->items[cmd->itemCount].quantity = tokenToInt(input, lexeme);
+                break;
+            case PARSE_ITEM:
+                cmd->items[cmd->itemCount++].name = lexeme;
+                break;
+            case PARSE_TRADE_SPLIT:
+                cmd->tradeSplit = cmd->itemCount;
+                break;
+            case PARSE_SUBJECT:
+                cmd->subject = lexeme;
+                break;
+            case PARSE_EXTEND_SUBJECT:
+                cmd->subject.length = lexeme.start + lexeme.length - cmd->subject.start;
+                break;
+            case PARSE_TARGET:
+                cmd->target = lexeme;
+                break;
+            case PARSE_SIGN:
+                cmd->counterIsSign = true;
+                break;
+            case PARSE_INGREDIENT_CATEGORY:
+                cmd->category = CATEGORY_INGREDIENT;
+                break;
+            case PARSE_POTION_CATEGORY:
+                cmd->category = CATEGORY_POTION;
+                break;
+            case PARSE_TROPHY_CATEGORY:
+                cmd->category = CATEGORY_TROPHY;
+                break;
+            default:
+                break;
         }
-    }
 
-    return count;
+        state = next;
+    }
 }
 
+/**
+ * @brief A block of the scratch arena.
+ */
+typedef struct ScratchBlock {
+    struct ScratchBlock* previous;  /**< Block filled before this one */
+    size_t capacity;                /**< Size of data in bytes */
+    size_t used;                    /**< Bytes of data handed out */
+    max_align_t data[];             /**< The memory handed out */
+} ScratchBlock;
 
+/** Newest block of the scratch arena, which holds the temporary arrays of one command. */
+static ScratchBlock* scratch = NULL;
 
 /**
- * @brief Checks for a comma spacing error in the token list.
+ * @brief Takes memory from the scratch arena; it stays valid until the
+ * command that took it has been executed.
  *
- * Scans the token array for the special marker "ERROR_NO_SPACE_AFTER_COMMA",
- * which indicates a missing space after a comma in the original input.
- *
- * @param tokens The array of token strings.
- * @param count The number of tokens in the array.
- * @return true if a comma spacing error is found, false otherwise.
+ * @param size Number of bytes.
+ * @return The memory, suitably aligned for any type.
  */
-bool hasCommaSpacingError(const char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH], int count) {
-    for (int i = 0; i < count; i++) {
-        if (strcmp(tokens[i], "ERROR_NO_SPACE_AFTER_COMMA") == 0) {
-            return true;
-        }
+static void* scratchAlloc(size_t size) {
+    size = (size + sizeof(max_align_t) - 1) / sizeof(max_align_t) * sizeof(max_align_t);
+
+    // Start a larger block when the newest one is full; earlier blocks stay in use
+    if (scratch == NULL || scratch->capacity - scratch->used < size) {
+        size_t capacity = scratch != NULL ? scratch->capacity * 2 : SCRATCH_BLOCK_BYTES;
+        while (capacity < size)
+            capacity *= 2;
+
+        ScratchBlock* block = xrealloc(NULL, sizeof(ScratchBlock) + capacity);
+        block->previous = scratch;
+        block->capacity = capacity;
+        block->used = 0;
+        scratch = block;
     }
-    return false;
+
+    void* memory = (char*)scratch->data + scratch->used;
+    scratch->used += size;
+    return memory;
 }
 
 /**
- * @brief Checks if the input string is a valid loot action.
- *
- * A loot action is defined as "Geralt loots <quantity> <ingredient> [, <quantity> <ingredient>]...".
- * The function checks for the correct format and spacing.
- *
- * @param input The input string to check.
- * @return true if the input is a valid loot action, false otherwise.
+ * @brief Empties the scratch arena, keeping only its newest and largest block.
  */
-bool isLootAction(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    // Check for comma spacing errors
-    if (hasCommaSpacingError(tokens, count)) {
-        return false;
-    }
-    
-    // Minimum tokens for a loot action: "Geralt", "loots", quantity, ingredient
-    if (count < 4) return false;
-    
-    // Check first two tokens
-    if (strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "loots") != 0)
-        return false;
-    
-    // Check pattern of: quantity, ingredient [, quantity, ingredient]...
-    for (int i = 2; i < count; i += 3) {
-        // Check quantity is a positive integer
-        if (!isPositiveInteger(tokens[i]))
-            return false;
-        
-        // Check ingredient is alphabetic
-        if (i + 1 >= count || !isAlphabeticOnly(tokens[i + 1]))
-            return false;
-        
-        // If there are more tokens, check for comma
-        if (i + 2 < count) {
-            if (strcmp(tokens[i + 2], ",") != 0)
-                return false;
-        }
-    }
-    
-    // Check if the last token is a comma
-    if (count > 0 && strcmp(tokens[count-1], ",") == 0) {
-        return false;
+static void resetScratch(void) {
+    if (scratch == NULL)
+        return;
+
+    while (scratch->previous != NULL) {
+        ScratchBlock* block = scratch->previous;
+        scratch->previous = block->previous;
+        free(block);
     }
-    
-    return true;
+    scratch->used = 0;
 }
 
 /**
- * @brief Checks if the input string is a valid trade action.
+ * @brief Executes the command based on the command type.
  *
- * A trade action is defined as "Geralt trades <quantity> <trophy> [, <quantity> <trophy>]... for <quantity> <ingredient> [, <quantity> <ingredient>]...".
- * The function checks for the correct format and spacing.
+ * Temporary arrays the command takes from the scratch arena are released
+ * once it has been executed.
  *
- * @param input The input string to check.
- * @return true if the input is a valid trade action, false otherwise.
+ * @param cmd The parsed command to execute.
+ * @return 0 on success, -1 on failure.
  */
-bool isTradeAction(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-
-    // Check first two tokens
-    if (strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "trades") != 0)
-        return false;
-
-    
-    // Find "for"
-    int forIndex = -1;
-    for (int i = 2; i < count; i++) {
-        if (strcmp(tokens[i], "for") == 0) {
-            forIndex = i;
+int executeCommand(const Command* cmd) {
+    int result;
+    switch (cmd->type) {
+        case ACTION_LOOT:
+            result = executeLootAction(cmd);
+            break;
+        case ACTION_TRADE:
+            result = executeTradeAction(cmd);
+            break;
+        case ACTION_BREW:
+            result = executeBrewAction(cmd);
+            break;
+        case KNOWLEDGE_EFFECTIVENESS:
+            result = executeEffectivenessKnowledge(cmd);
+            break;
+        case KNOWLEDGE_POTION_FORMULA:
+            result = executeFormulaKnowledge(cmd);
+            break;
+        case ENCOUNTER:
+            result = executeEncounter(cmd);
+            break;
+        case QUERY_SPECIFIC_INVENTORY:
+            result = executeSpecificInventoryQuery(cmd);
+            break;
+        case QUERY_ALL_INVENTORY:
+            result = executeAllInventoryQuery(cmd);
+            break;
+        case QUERY_BESTIARY:
+            result = executeBestiaryQuery(cmd);
+            break;
+        case QUERY_ALCHEMY:
+            result = executeAlchemyQuery(cmd);
+            break;
+        case EXIT_COMMAND:
+            result = 0;
+            break;
+        default:
+            result = -1;
             break;
-        }
     }
 
-    if (forIndex == -1 || forIndex <= 4 || forIndex >= count - 2) return false;
-
-    // Trophy list validation: from index 2 to forIndex - 1
-    int i = 2;
-    bool expectingQuantity = true;
-    bool lastTrophyHasKeyword = false;
-
-    while (i < forIndex) {
-        // Quantity
-        if (expectingQuantity) {
-            if (!isPositiveInteger(tokens[i])) return false;
-            i++;
-            expectingQuantity = false;
-        }
-
-        // Monster name
-        else if (!isAlphabeticOnly(tokens[i])) {
-            return false;
-        } else {
-            i++;
-            // If we're at the last trophy pair
-            if (i < forIndex && strcmp(tokens[i], "trophy") == 0 && i + 1 == forIndex) {
-                lastTrophyHasKeyword = true;
-                i++;
-            } else if (i < forIndex && strcmp(tokens[i], ",") == 0) {
-                i++;
-                expectingQuantity = true;
-            } else {
-                // Must either be 'trophy' at end or comma between entries
-                return false;
-            }
-        }
-    }
+    resetScratch();
+    return result;
+}
 
-    if (!lastTrophyHasKeyword) return false;
 
-    // Ingredient list after "for"
-    i = forIndex + 1;
-    expectingQuantity = true;
+/**
+ * @brief An interned name.
+ *
+ * A name shorter than NAME_INLINE_LENGTH is kept, NUL-terminated, in the
+ * entry itself, in place of the offset; a longer one is kept in nameChars.
+ * Either way an entry takes 16 bytes.
+ */
+typedef struct {
+    uint32_t hash;      /**< Low bits of the name's hash, to skip most compares */
+    int length;         /**< Length of the name */
+    union {
+        char text[NAME_INLINE_LENGTH];  /**< A short name */
+        size_t offset;                  /**< Offset of a long name in nameChars */
+    };
+} NameEntry;
+
+_Static_assert(sizeof(NameEntry) == 16, "inline names must not grow NameEntry");
+
+/** Characters of the interned names too long to keep inline, each followed by a NUL. */
+static char* nameChars = NULL;
+static size_t nameCharsLength = 0;
+static size_t nameCharsCapacity = 0;
+/** Interned names, indexed by NameId; entry 0 is unused. */
+static NameEntry* nameEntries = NULL;
+static size_t nameEntriesCapacity = 0;
+static NameId nameCount = 0;
+/** Open-addressing hash table of NameIds, 0 for a free slot. */
+static NameId* nameSlots = NULL;
+static size_t nameSlotCount = 0;
 
-    while (i < count) {
-        // Check for quantity
-        if (expectingQuantity) {
-            if (!isPositiveInteger(tokens[i])) return false;
-            i++;
-            expectingQuantity = false;
-            
-            // If we hit the end after a number, it's invalid
-            if (i == count) return false;
-        } 
-        // Check for ingredient name
-        else if (!isAlphabeticOnly(tokens[i])) {
-            return false;
-        } else {
-            i++;
-            // Now we have a complete quantity-ingredient pair
-            
-            // If we've reached the end, we're good
-            if (i == count) {
-                break;
-            }
-            
-            if (strcmp(tokens[i], ",") == 0) {
-                i++;
-                expectingQuantity = true;
-                
-                // Check if this comma is the last token (trailing comma)
-                if (i == count) {
-                    return false;
-                }
-            } else {
-                return false;
-            }
-        }
-    }
+/**
+ * @brief Doubles the name hash table and reinserts every name.
+ */
+static void growNameSlots(void) {
+    size_t count = nameSlotCount > 0 ? nameSlotCount * 2 : 1024;
+    NameId* slots = xcalloc(count, sizeof(NameId));
 
-    // Make sure we're not expecting another quantity-ingredient pair
-    if (expectingQuantity) {
-        return false;
+    for (NameId id = 1; id <= nameCount; id++) {
+        size_t i = nameEntries[id].hash & (count - 1);
+        while (slots[i] != 0)
+            i = (i + 1) & (count - 1);
+        slots[i] = id;
     }
 
-    return true;
+    free(nameSlots);
+    nameSlots = slots;
+    nameSlotCount = count;
 }
 
 /**
- * @brief Checks if the input string is a valid brew action.
+ * @brief Finds the bucket of a name in the name hash table.
  *
- * A brew action is defined as "Geralt brews <potion_name>".
- * The function checks for the correct format and spacing.
- *
- * @param input The input string to check.
- * @return true if the input is a valid brew action, false otherwise.
+ * @param text The name; need not be NUL-terminated.
+ * @param length Length of the name.
+ * @param hash Low bits of the name's hash.
+ * @return The bucket holding the name, or the free bucket it would go in.
  */
-bool isBrewAction(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Minimum tokens: "Geralt", "brews", potion_name
-    if (count < 3) return false;
-    
-    // Check first two tokens
-    if (strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "brews") != 0)
-        return false;
-    
-    // Check if the potion name contains only alphabetic characters and spaces
-    char* potionName = tokens[2];
-    char* p = potionName;
-    
-    bool lastWasSpace = false;
-
-    while (*p) {
-        if (*p == ' ') {
-            if (lastWasSpace) // two consecutive spaces
-                return false;
-            lastWasSpace = true;
-        } else if (!isalpha(*p)) {
-            return false;
-        } else {
-            lastWasSpace = false;
-        }
-        p++;
+static size_t findNameSlot(const char* text, int length, uint32_t hash) {
+    size_t i = hash & (nameSlotCount - 1);
+    while (nameSlots[i] != 0) {
+        const NameEntry* entry = &nameEntries[nameSlots[i]];
+        if (entry->hash == hash && entry->length == length &&
+            memcmp(nameText(nameSlots[i]), text, length) == 0)
+            break;
+        i = (i + 1) & (nameSlotCount - 1);
     }
-    
-    return true;
+    return i;
 }
+
 /**
- * @brief Checks if the input string is a valid potion name token.
+ * @brief Returns the ID of a name without interning it.
  *
- * A valid potion name token consists of alphabetic characters and spaces,
- * but cannot have two consecutive spaces.
+ * A name that was never interned cannot be in any table, so commands that
+ * only look names up use this and leave the name table alone.
  *
- * @param token The input string to check.
- * @return true if the input is a valid potion name token, false otherwise.
+ * @param text The name; need not be NUL-terminated.
+ * @param length Length of the name.
+ * @return The name's ID, or 0 if it was never interned.
  */
+NameId findName(const char* text, int length) {
+    if (nameSlotCount == 0)
+        return 0;
+    return nameSlots[findNameSlot(text, length, (uint32_t)hashText(text, length))];
+}
 
-bool isValidPotionNameToken(const char* token) {
-    const char* p = token;
-    bool lastWasSpace = false;
-
-    if (*p == '\0') return false;  // Empty
-
-    while (*p) {
-        if (*p == ' ') {
-            if (lastWasSpace) // two consecutive spaces
-                return false;
-            lastWasSpace = true;
-        } else if (!isalpha(*p)) {
-            return false;
-        } else {
-            lastWasSpace = false;
-        }
-        p++;
+/**
+ * @brief Returns the ID of a name, interning it if it is new.
+ *
+ * Every distinct name is stored once and gets the next free ID, so two
+ * names are equal exactly when their IDs are.
+ *
+ * @param text The name; need not be NUL-terminated.
+ * @param length Length of the name.
+ * @return The name's ID, never 0.
+ */
+NameId internName(const char* text, int length) {
+    // Keep the table at most half full
+    if ((size_t)(nameCount + 1) * 2 > nameSlotCount)
+        growNameSlots();
+
+    uint32_t hash = (uint32_t)hashText(text, length);
+    size_t i = findNameSlot(text, length, hash);
+    if (nameSlots[i] != 0)
+        return nameSlots[i];
+
+    NameId id = ++nameCount;
+    reserveBuffer((void**)&nameEntries, &nameEntriesCapacity, (id + 1) * sizeof(NameEntry));
+
+    NameEntry* entry = &nameEntries[id];
+    entry->hash = hash;
+    entry->length = length;
+    if (length < NAME_INLINE_LENGTH) {
+        memcpy(entry->text, text, length);
+        entry->text[length] = '\0';
+    } else {
+        reserveBuffer((void**)&nameChars, &nameCharsCapacity, nameCharsLength + length + 1);
+        entry->offset = nameCharsLength;
+        memcpy(nameChars + nameCharsLength, text, length);
+        nameChars[nameCharsLength + length] = '\0';
+        nameCharsLength += length + 1;
     }
 
-    return true;
+    nameSlots[i] = id;
+    return id;
 }
 
 /**
- * @brief Checks if the input string is a valid effectiveness knowledge statement.
+ * @brief Returns the text of an interned name.
  *
- * An effectiveness knowledge statement is defined as "Geralt learns <item_name> potion/sign is effective against <monster_name>".
- * The function checks for the correct format and spacing.
+ * The pointer is only valid until the next name is interned.
  *
- * @param input The input string to check.
- * @return true if the input is a valid effectiveness knowledge statement, false otherwise.
+ * @param id The name's ID.
+ * @return The NUL-terminated name.
  */
-bool isEffectivenessKnowledge(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-
-
-    // Must start with Geralt learns
-    if (count < 5 || strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "learns") != 0)
-        return false;
-
-    // Look for pattern: <item> "potion"/"sign" "is" "effective" "against" <monster>
-    const char* type = tokens[3]; // "potion" or "sign"
-    const char* itemName = tokens[2];
-
-    if (!(strcmp(type, "potion") == 0 || strcmp(type, "sign") == 0))
-        return false;
-
-    if (strcmp(tokens[4], "is") != 0 ||
-        strcmp(tokens[5], "effective") != 0 ||
-        strcmp(tokens[6], "against") != 0)
-        return false;
+const char* nameText(NameId id) {
+    const NameEntry* entry = &nameEntries[id];
+    return entry->length < NAME_INLINE_LENGTH ? entry->text : nameChars + entry->offset;
+}
 
-    // Monster name should exist and be alphabetical
-    if (count != 8 || !isAlphabeticOnly(tokens[7]))
-        return false;
+/**
+ * @brief Appends an interned name to the output.
+ *
+ * @param id The name's ID.
+ */
+static void writeName(NameId id) {
+    writeOutput(nameText(id), nameEntries[id].length);
+}
 
-    // Validate sign name or potion name
-    if (strcmp(type, "sign") == 0) {
-        // Sign must be one word and alphabetic
-        return isAlphabeticOnly(itemName);
-    } else {
-        // Potion name may include spaces, validate structure
-        return isValidPotionNameToken(itemName);
+/**
+ * @brief Looks up the subject of a command that only reads the tables.
+ *
+ * The subject ID is 0 if the name was never interned. Since a later command
+ * may intern it, this is redone every time the command is executed.
+ *
+ * @param cmd A valid parsed command.
+ */
+void findCommandNames(Command* cmd) {
+    switch (cmd->type) {
+        case ACTION_BREW:
+        case ENCOUNTER:
+        case QUERY_SPECIFIC_INVENTORY:
+        case QUERY_BESTIARY:
+        case QUERY_ALCHEMY:
+            cmd->subjectId = findName(cmd->text + cmd->subject.start, cmd->subject.length);
+            break;
+        default:
+            break;
     }
 }
 
 /**
- * @brief Checks if the input string is a valid potion formula knowledge statement.
+ * @brief Interns the names a command refers to.
  *
- * A potion formula knowledge statement is defined as "Geralt learns <potion_name> potion consists of <quantity> <ingredient> [, <quantity> <ingredient>]...".
- * The function checks for the correct format and spacing.
+ * Fills in the subject, target and entry IDs the command's executor uses.
+ * Only commands that store names intern them; the rest look their subject
+ * up with findCommandNames(), so names that are only asked about are never
+ * kept. A brew or encounter succeeds only for a potion or beast already in
+ * a table, whose name is interned.
  *
- * @param input The input string to check.
- * @return true if the input is a valid potion formula knowledge statement, false otherwise.
+ * @param cmd A valid parsed command.
  */
+void internCommandNames(Command* cmd) {
+    for (int i = 0; i < cmd->itemCount; i++)
+        cmd->items[i].nameId = internName(cmd->text + cmd->items[i].name.start, cmd->items[i].name.length);
 
-bool isPotionFormulaKnowledge(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    if (count < 7) return false;
-
-    // Check for comma spacing issues
-    if (hasCommaSpacingError(tokens, count)) return false;
-    
-    // Check if the last token is a comma - this is invalid
-    if (count > 0 && strcmp(tokens[count-1], ",") == 0) {
-        return false;
+    switch (cmd->type) {
+        case KNOWLEDGE_EFFECTIVENESS:
+            cmd->targetId = internName(cmd->text + cmd->target.start, cmd->target.length);
+            // fall through
+        case KNOWLEDGE_POTION_FORMULA:
+            cmd->subjectId = internName(cmd->text + cmd->subject.start, cmd->subject.length);
+            break;
+        default:
+            findCommandNames(cmd);
+            break;
     }
+}
 
-    // Check the beginning
-    if (strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "learns") != 0)
-        return false;
-
-    // Find indexes
-    int potionIndex = -1, consistsIndex = -1, ofIndex = -1;
-    for (int i = 2; i < count; i++) {
-        if (potionIndex == -1 && strcmp(tokens[i], "potion") == 0)
-            potionIndex = i;
-        else if (consistsIndex == -1 && strcmp(tokens[i], "consists") == 0)
-            consistsIndex = i;
-        else if (ofIndex == -1 && strcmp(tokens[i], "of") == 0)
-            ofIndex = i;
-    }
+/**
+ * @brief Appends the subject of a command to the output, as written.
+ *
+ * Unlike writeName(), this also works for a subject that was never interned.
+ *
+ * @param cmd The command.
+ */
+static void writeSubject(const Command* cmd) {
+    writeOutput(cmd->text + cmd->subject.start, cmd->subject.length);
+}
 
-    // Ensure all are found
-    if (potionIndex == -1 || consistsIndex == -1 || ofIndex == -1)
-        return false;
 
-    // Ensure order
-    if (!(1 < potionIndex && potionIndex < consistsIndex && consistsIndex < ofIndex))
-        return false;
+/**
+ * @brief Open-addressing hash index from names to slots of an entity table.
+ *
+ * Each table holds a name in at most one slot.
+ */
+typedef struct {
+    NameId* names;      /**< Indexed names, 0 for a free bucket */
+    int* slots;         /**< Table slot of each indexed name */
+    size_t capacity;    /**< Number of buckets, a power of two */
+    size_t count;       /**< Number of indexed names */
+} NameIndex;
 
-    // Potion name should be alphabetic-only and come right after "learns" and before "potion"
-    for (int i = 2; i < potionIndex; i++) {
-        if (!isValidPotionNameToken(tokens[i])) return false;
-    }
+/**
+ * @brief Returns the first bucket to probe for a name.
+ *
+ * IDs are handed out consecutively, so multiplying by an odd constant
+ * spreads them evenly over the buckets.
+ *
+ * @param index The index.
+ * @param name The name.
+ * @return The bucket.
+ */
+static inline size_t nameBucket(const NameIndex* index, NameId name) {
+    return (name * 2654435761u) & (index->capacity - 1);
+}
 
-    // Ensure "potion consists of"
-    if (!(potionIndex + 1 == consistsIndex && consistsIndex + 1 == ofIndex))
-        return false;
+/**
+ * @brief Looks up the slot of a name.
+ *
+ * @param index The index of the table.
+ * @param name The name to find.
+ * @return The slot holding the name, or -1 if the table does not have it.
+ */
+static int findByName(const NameIndex* index, NameId name) {
+    if (index->count == 0)
+        return -1;
 
-    // Ingredient list: after "of"
-    int i = ofIndex + 1;
-    bool expectingIngredient = false;
-    
-    while (i < count) {
-        // Quantity
-        if (i >= count || !isPositiveInteger(tokens[i])) return false;
-        i++;
-
-        // Ingredient
-        if (i >= count || !isAlphabeticOnly(tokens[i])) return false;
-        i++;
-
-        // Optional comma
-        if (i < count) {
-            if (strcmp(tokens[i], ",") == 0) {
-                i++;
-                // If comma is the last token, that's invalid
-                if (i == count) return false;
-            } else {
-                // If there's something else instead of comma, it must be the last item
-                if ((count - i) >= 1) return false;
-            }
-        }
+    for (size_t i = nameBucket(index, name); index->names[i] != 0; i = (i + 1) & (index->capacity - 1)) {
+        if (index->names[i] == name)
+            return index->slots[i];
     }
-
-    return true;
+    return -1;
 }
 
-
 /**
- * @brief Checks if the input string is a valid encounter sentence.
+ * @brief Records that a slot holds a name.
  *
- * An encounter sentence is defined as "Geralt encounters a <monster_name>".
- * The function checks for the correct format and spacing.
+ * The name must not be indexed yet.
  *
- * @param input The input string to check.
- * @return true if the input is a valid encounter sentence, false otherwise.
+ * @param index The index of the table.
+ * @param name The name stored in the slot.
+ * @param slot The slot.
  */
-
-bool isEncounterSentence(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Required pattern: "Geralt", "encounters", "a", <monster>
-    if (count != 4) return false;
-    
-    if (strcmp(tokens[0], "Geralt") != 0 || 
-        strcmp(tokens[1], "encounters") != 0 || 
-        strcmp(tokens[2], "a") != 0)
-        return false;
-    
-    // Validate monster name is alphabetic
-    if (!isAlphabeticOnly(tokens[3]))
-        return false;
-    
-    return true;
+static void indexName(NameIndex* index, NameId name, int slot) {
+    // Keep the index at most half full
+    if ((index->count + 1) * 2 > index->capacity) {
+        NameIndex grown = {0};
+        grown.capacity = index->capacity > 0 ? index->capacity * 2 : 64;
+        grown.names = xcalloc(grown.capacity, sizeof(NameId));
+        grown.slots = xrealloc(NULL, grown.capacity * sizeof(int));
+        for (size_t i = 0; i < index->capacity; i++) {
+            if (index->names[i] != 0)
+                indexName(&grown, index->names[i], index->slots[i]);
+        }
+        free(index->names);
+        free(index->slots);
+        *index = grown;
+    }
+
+    size_t i = nameBucket(index, name);
+    while (index->names[i] != 0)
+        i = (i + 1) & (index->capacity - 1);
+
+    index->names[i] = name;
+    index->slots[i] = slot;
+    index->count++;
 }
 
 
 /**
- * @brief Checks if the input string is a valid inventory query.
- *
- * An inventory query is defined as "Total <category> [<item_name>] ?".
- * The function checks for the correct format and spacing.
+ * @brief Growable table of fixed-size entities.
  *
- * @param input The input string to check.
- * @param isSpecific Pointer to a boolean that will be set to true if the query is specific.
- * @return true if the input is a valid inventory query, false otherwise.
+ * Slots are handed out front to back and live in chunks of TABLE_CHUNK_SIZE
+ * entities, so a slot never moves once it is handed out and memory grows
+ * with the number of slots in use.
  */
+typedef struct {
+    char** chunks;          /**< Chunks of zero-initialised entities */
+    size_t chunkCount;      /**< Number of allocated chunks */
+    size_t chunkCapacity;   /**< Size of the chunk pointer array */
+    size_t entitySize;      /**< Size of one entity in bytes */
+    int count;              /**< Number of slots handed out, starting at slot 0 */
+} EntityTable;
 
-bool isInventoryQuery(const char* input, bool* isSpecific) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
+/**
+ * @brief Returns the address of a slot handed out by a table.
+ *
+ * @param table The table.
+ * @param slot The slot, below table->count.
+ * @return The entity stored in the slot.
+ */
+static inline void* tableSlot(const EntityTable* table, int slot) {
+    return table->chunks[slot >> TABLE_CHUNK_BITS] + (size_t)(slot & (TABLE_CHUNK_SIZE - 1)) * table->entitySize;
+}
 
-    if (count < 3 || count > 4) return false;
+/**
+ * @brief Hands out the next free slot of a table, adding a chunk when needed.
+ *
+ * @param table The table.
+ * @return The new slot; its entity is zeroed.
+ */
+static int appendSlot(EntityTable* table) {
+    if ((size_t)table->count == table->chunkCount * TABLE_CHUNK_SIZE) {
+        if (table->chunkCount == table->chunkCapacity) {
+            size_t capacity = table->chunkCapacity > 0 ? table->chunkCapacity * 2 : 16;
+            table->chunks = xrealloc(table->chunks, capacity * sizeof(char*));
+            table->chunkCapacity = capacity;
+        }
 
-    // Make sure the last token is "?"
-    if (strcmp(tokens[count - 1], "?") != 0)
-        return false;
+        // Slots are ints, so the table cannot grow past INT_MAX
+        if (table->count == INT_MAX - TABLE_CHUNK_SIZE + 1)
+            outOfMemory();
+        table->chunks[table->chunkCount++] = xcalloc(TABLE_CHUNK_SIZE, table->entitySize);
+    }
+    return table->count++;
+}
 
-    // Must start with "Total"
-    if (strcmp(tokens[0], "Total") != 0)
-        return false;
+/**
+ * @brief Names and quantities of one category of inventory items.
+ *
+ * The two fields are kept in parallel columns. Slots are handed out front
+ * to back and keep their index as the columns grow.
+ *
+ * The slots with a positive quantity are also linked into a skip list in
+ * name order, so the category can be listed without a scan or a sort. Each
+ * slot gets its node of 1 to STOCK_LEVELS links when it is handed out. A
+ * link holds the next slot plus one, or 0 at the end of a level.
+ */
+typedef struct {
+    NameId* names;                /**< Interned name of each slot */
+    int* quantities;              /**< Quantity of each slot */
+    int* nodes;                   /**< Offset of each slot's links in links */
+    unsigned char* heights;       /**< Number of links of each slot */
+    int count;                    /**< Number of slots handed out */
+    int capacity;                 /**< Size of the columns */
+    int* links;                   /**< Links of all nodes */
+    size_t linksCapacity;         /**< Size of links in bytes */
+    int linksLength;              /**< Number of links used */
+    int head[STOCK_LEVELS];       /**< First listed slot plus one at each level */
+    uint32_t random;              /**< State of the node height generator */
+} StockTable;
 
-    // Category must be one of: ingredient, potion, trophy
-    if (strcmp(tokens[1], "ingredient") != 0 &&
-        strcmp(tokens[1], "potion") != 0 &&
-        strcmp(tokens[1], "trophy") != 0)
-        return false;
+/**
+ * @brief Hands out the next slot of a stock table, with a zero quantity.
+ *
+ * @param stock The table.
+ * @param name Name of the new slot.
+ * @return The new slot.
+ */
+static int appendStock(StockTable* stock, NameId name) {
+    if (stock->count == stock->capacity) {
+        int capacity = stock->capacity > 0 ? stock->capacity * 2 : 64;
+        stock->names = xrealloc(stock->names, capacity * sizeof(NameId));
+        stock->quantities = xrealloc(stock->quantities, capacity * sizeof(int));
+        stock->nodes = xrealloc(stock->nodes, capacity * sizeof(int));
+        stock->heights = xrealloc(stock->heights, capacity);
+        stock->capacity = capacity;
+    }
+
+    // Each level above the first holds a quarter of the nodes of the one below
+    if (stock->random == 0)
+        stock->random = 2463534242u;
+    int height = 1;
+    while (height < STOCK_LEVELS) {
+        stock->random ^= stock->random << 13;
+        stock->random ^= stock->random >> 17;
+        stock->random ^= stock->random << 5;
+        if ((stock->random & 3) != 0)
+            break;
+        height++;
+    }
+    reserveBuffer((void**)&stock->links, &stock->linksCapacity, (size_t)(stock->linksLength + height) * sizeof(int));
 
-    // Specific query if there's an item name before the "?"
-    *isSpecific = (count == 4);  // Total + category + name + '?'
+    stock->names[stock->count] = name;
+    stock->quantities[stock->count] = 0;
+    stock->nodes[stock->count] = stock->linksLength;
+    stock->heights[stock->count] = (unsigned char)height;
+    stock->linksLength += height;
+    return stock->count++;
+}
 
-    if (*isSpecific) {
-        if (strcmp(tokens[1], "ingredient") == 0 || strcmp(tokens[1], "trophy") == 0) {
-            if(!isAlphabeticOnly(tokens[2])) {
-                return false;
-            }
-        } else if (strcmp(tokens[1], "potion") == 0) {
+/**
+ * @brief Returns the link that follows a slot, or the list head, at a level.
+ *
+ * @param stock The table.
+ * @param slot The slot, or -1 for the head.
+ * @param level The level.
+ * @return The link.
+ */
+static inline int* stockLink(StockTable* stock, int slot, int level) {
+    return slot == -1 ? &stock->head[level] : &stock->links[stock->nodes[slot] + level];
+}
 
-            if (!isValidPotionNameToken(tokens[2])) {
-                return false;
-            }
+/**
+ * @brief Finds, at every level, the last listed slot named before a slot.
+ *
+ * @param stock The table.
+ * @param slot The slot.
+ * @param before Receives the slot, or -1 for the head, at each level.
+ */
+static void findStockPosition(StockTable* stock, int slot, int before[STOCK_LEVELS]) {
+    const char* name = nameText(stock->names[slot]);
+    int current = -1;
+    for (int level = STOCK_LEVELS - 1; level >= 0; level--) {
+        int next = *stockLink(stock, current, level) - 1;
+        while (next != -1 && strcmp(nameText(stock->names[next]), name) < 0) {
+            current = next;
+            next = *stockLink(stock, current, level) - 1;
         }
+        before[level] = current;
     }
-
-    // All checks passed — it's a valid inventory query
-    return true;
 }
 
-
-
 /**
- * @brief Checks if the input string is a valid bestiary query.
+ * @brief Changes the quantity of a slot, keeping the name-ordered list of
+ * slots with a positive quantity up to date.
  *
- * A bestiary query is defined as "What is effective against <monster_name> ?".
- * The function checks for the correct format and spacing.
- *
- * @param input The input string to check.
- * @return true if the input is a valid bestiary query, false otherwise.
+ * @param stock The table.
+ * @param slot The slot.
+ * @param change The amount to add; negative to take away.
  */
-bool isBestiaryQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
+static void addStock(StockTable* stock, int slot, int change) {
+    bool wasListed = stock->quantities[slot] > 0;
+    stock->quantities[slot] += change;
+    bool listed = stock->quantities[slot] > 0;
+    if (listed == wasListed)
+        return;
+
+    int before[STOCK_LEVELS];
+    findStockPosition(stock, slot, before);
+    for (int level = 0; level < stock->heights[slot]; level++) {
+        int* link = stockLink(stock, before[level], level);
+        int* own = stockLink(stock, slot, level);
+        if (listed) {
+            *own = *link;
+            *link = slot + 1;
+        } else if (*link == slot + 1) {
+            *link = *own;
+        }
+    }
+}
 
+/** All available ingredients. */
+static StockTable ingredients = {0};
+/** Slot of each ingredient name. */
+static NameIndex ingredientsByName = {0};
 
-    // Expected pattern: What is effective against <monster> ?
-    if (count != 6) return false;
+/** All collected trophies. */
+static StockTable trophies = {0};
+/** Slot of each trophy name. */
+static NameIndex trophiesByName = {0};
+
+/** Names and quantities of known potions; their recipes are in potionTable. */
+static StockTable potions = {0};
 
-    if (strcmp(tokens[0], "What") != 0 || 
-        strcmp(tokens[1], "is") != 0 || 
-        strcmp(tokens[2], "effective") != 0 || 
-        strcmp(tokens[3], "against") != 0)
-        return false;
 
-    if (!isAlphabeticOnly(tokens[4])) return false;
 
-    if (strcmp(tokens[5], "?") != 0) return false;
+/**
+ * @brief A query answer rendered once and written again until its source changes.
+ */
+typedef struct {
+    char* text;                   /**< The answer, including its newline */
+    size_t length;                /**< Length of the answer, 0 before it is rendered */
+    size_t capacity;              /**< Size of text */
+    unsigned version;             /**< Version of the source it was rendered from */
+} RenderedAnswer;
 
-    return true;
+/**
+ * @brief Appends bytes to a rendered answer.
+ *
+ * @param answer The answer.
+ * @param data The bytes.
+ * @param length Number of bytes.
+ */
+static void appendAnswer(RenderedAnswer* answer, const char* data, size_t length) {
+    if (answer->length + length > answer->capacity) {
+        size_t capacity = answer->capacity > 0 ? answer->capacity : 64;
+        while (capacity < answer->length + length)
+            capacity *= 2;
+        answer->text = xrealloc(answer->text, capacity);
+        answer->capacity = capacity;
+    }
+    memcpy(answer->text + answer->length, data, length);
+    answer->length += length;
 }
 
 /**
- * @brief Checks if the input string is a valid alchemy query.
- *
- * An alchemy query is defined as "What is in <potion_name> ?".
- * The function checks for the correct format and spacing.
+ * @brief Appends an interned name to a rendered answer.
  *
- * @param input The input string to check.
- * @return true if the input is a valid alchemy query, false otherwise.
+ * @param answer The answer.
+ * @param id The name's ID.
  */
-bool isAlchemyQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-
+static void appendAnswerName(RenderedAnswer* answer, NameId id) {
+    appendAnswer(answer, nameText(id), nameEntries[id].length);
+}
 
-    // Expected pattern: What is in <potion words...> ?
-    if (count < 5) return false;
+/**
+ * @brief Appends an integer in decimal to a rendered answer.
+ *
+ * @param answer The answer.
+ * @param value The integer.
+ */
+static void appendAnswerInt(RenderedAnswer* answer, int value) {
+    char digits[12];
+    char* p = formatInt(value, digits + sizeof(digits));
+    appendAnswer(answer, p, digits + sizeof(digits) - p);
+}
 
-    if (strcmp(tokens[0], "What") != 0 || 
-        strcmp(tokens[1], "is") != 0 || 
-        strcmp(tokens[2], "in") != 0)
-        return false;
 
-    if (strcmp(tokens[count - 1], "?") != 0) return false;
 
-    // Check that all tokens between "in" and "?" are valid potion words
-    for (int i = 3; i < count - 1; i++) {
-        if (!isValidPotionNameToken(tokens[i])) return false;
-    }
+/**
+ * @brief One ingredient of a potion recipe.
+ */
+typedef struct {
+    int ingredient;               /**< Slot of the required ingredient */
+    int quantity;                 /**< Quantity of it */
+} RecipeEntry;
 
-    return true;
-}
+/** Recipes of all known potions, packed back to back in learning order. */
+static RecipeEntry* recipeArena = NULL;
+/** Size of recipeArena in bytes. */
+static size_t recipeArenaCapacity = 0;
+/** Number of entries used in recipeArena. */
+static int recipeArenaLength = 0;
 
+/**
+ * @brief Represents the formula of a potion composed of ingredients.
+ */
+typedef struct {
+    int recipe_offset;            /**< First entry of the recipe in recipeArena */
+    int ingredients_count;        /**< Total number of ingredients */
+    RenderedAnswer answer;        /**< Answer to "What is in", rendered when the formula is learned */
+} Potion;
 
 /**
- * @brief Checks if the input string is a valid exit command.
+ * @brief Returns the recipe of a potion.
  *
- * An exit command is defined as "Exit".
- * The function checks for the correct format and spacing.
+ * The pointer is valid until the next formula is learned.
  *
- * @param input The input string to check.
- * @return true if the input is a valid exit command, false otherwise.
+ * @param potion The potion.
+ * @return Its ingredients_count recipe entries.
  */
-
-bool isExitCommand(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    return count == 1 && strcmp(tokens[0], "Exit") == 0;
+static inline const RecipeEntry* potionRecipe(const Potion* potion) {
+    return recipeArena + potion->recipe_offset;
 }
 
 /**
- * @brief Executes the command based on the command type.
+ * @brief Checks whether a recipe entry is listed before another.
  *
- * @param input The input string to execute.
- * @param cmdType The type of command to execute.
- * @return 0 on success, -1 on failure.
+ * Recipes are kept in the order "What is in" lists them: by quantity,
+ * largest first, and then by ingredient name.
+ *
+ * @param a The first entry.
+ * @param b The second entry.
+ * @return 1 if a comes before b, 0 otherwise.
  */
-int executeCommand(const char* input, CommandType cmdType) {
-    switch (cmdType) {
-        case ACTION_LOOT:
-            return executeLootAction(input);
-        case ACTION_TRADE:
-            return executeTradeAction(input);
-        case ACTION_BREW:
-            return executeBrewAction(input);
-        case KNOWLEDGE_EFFECTIVENESS:
-            return executeEffectivenessKnowledge(input);
-        case KNOWLEDGE_POTION_FORMULA:
-            return executeFormulaKnowledge(input);
-        case ENCOUNTER:
-            return executeEncounter(input);
-        case QUERY_SPECIFIC_INVENTORY:
-            return executeSpecificInventoryQuery(input);
-        case QUERY_ALL_INVENTORY:
-            return executeAllInventoryQuery(input);
-        case QUERY_BESTIARY:
-            return executeBestiaryQuery(input);
-        case QUERY_ALCHEMY:
-            return executeAlchemyQuery(input);
-        case EXIT_COMMAND:
-            return 0;
-        default:
-            return -1;
-    }
-
+static int recipeEntryPrecedes(const RecipeEntry* a, const RecipeEntry* b) {
+    if (a->quantity != b->quantity)
+        return a->quantity > b->quantity;
+    return strcmp(nameText(ingredients.names[a->ingredient]), nameText(ingredients.names[b->ingredient])) < 0;
 }
 
+/** Formulas of known potions, in the slots of the potions stock. */
+static EntityTable potionTable = { .entitySize = sizeof(Potion) };
+/** Slot of each potion name. */
+static NameIndex potionsByName = {0};
 
 /**
- * @brief Represents an alchemical ingredient with a name and quantity.
+ * @brief Returns a potion slot.
+ *
+ * @param slot The slot.
+ * @return The potion.
  */
-typedef struct {
-    char name[MAX_TOKEN_LENGTH];  /**< Name of the ingredient */
-    int quantity;                 /**< Available quantity */
-} Ingredient;
-
-/** Global list of all available ingredients. */
-static Ingredient ingredients[MAX_INGREDIENTS] = {0};
-/** Number of currently stored ingredients. */
-static int num_ingredients = 0;
-
-
+static inline Potion* potionAt(int slot) {
+    return tableSlot(&potionTable, slot);
+}
 
 /**
- * @brief Represents a trophy with a name and quantity.
+ * @brief Adds a potion: a row of the potions stock and, in the same slot,
+ * its formula in potionTable.
+ *
+ * This is the only place either table grows, which keeps their slots equal.
+ *
+ * @param name Name of the potion.
+ * @return The potion's slot in both tables.
  */
-typedef struct {
-    char name[MAX_TOKEN_LENGTH];  /**< Name of the trophy */
-    int quantity;                 /**< Number of this trophy */
-} Trophy;
-
-/** Global list of all collected trophies. */
-static Trophy trophies[MAX_TROPHIES] = {0};
+static int appendPotion(NameId name) {
+    int slot = appendStock(&potions, name);
+    int formulaSlot = appendSlot(&potionTable);
+    assert(formulaSlot == slot);
+    (void)formulaSlot;
+    return slot;
+}
 
 
 
+/**
+ * @brief Kinds of counters that can be effective against beasts.
+ */
+typedef enum {
+    COUNTER_SIGN,
+    COUNTER_POTION
+} CounterKind;
 
 /**
- * @brief Represents a potion composed of ingredients.
+ * @brief A sign or potion known to be effective against some beast.
+ *
+ * There is one counter per kind and name. A potion counter is linked to the
+ * potion slot of the same name as soon as that formula is known.
  */
 typedef struct {
-    char name[MAX_TOKEN_LENGTH];                         /**< Name of the potion */
-    int ingredient_indices[MAX_POTION_INGREDIENTS];      /**< Indices of required ingredients */
-    int ingredient_quantities[MAX_POTION_INGREDIENTS];   /**< Quantities for each ingredient */
-    int ingredients_count;                               /**< Total number of ingredients */
-    int quantity;                                        /**< Quantity of the potion available */
-} Potion;
+    NameId name;                  /**< Interned name of the sign or potion */
+    CounterKind kind;             /**< Whether it is a sign or a potion */
+    int potion;                   /**< Slot of the potion, -1 for a sign or an unknown formula */
+} Counter;
+
+/** Registry of all counters. */
+static EntityTable counterTable = { .entitySize = sizeof(Counter) };
+/** Slot of each sign counter name. */
+static NameIndex signCountersByName = {0};
+/** Slot of each potion counter name. */
+static NameIndex potionCountersByName = {0};
 
-/** Global list of known potions. */
-static Potion potions[MAX_POTIONS] = {0};
-/** Number of known potions. */
-static int potionsCount = 0;
+/**
+ * @brief Returns a counter slot.
+ *
+ * @param slot The slot.
+ * @return The counter.
+ */
+static inline Counter* counterAt(int slot) {
+    return tableSlot(&counterTable, slot);
+}
 
+/**
+ * @brief Looks up the counter of a kind and name, registering it if needed.
+ *
+ * @param kind The kind of counter.
+ * @param name Its name.
+ * @return The counter slot.
+ */
+static int registerCounter(CounterKind kind, NameId name) {
+    NameIndex* index = kind == COUNTER_SIGN ? &signCountersByName : &potionCountersByName;
+    int slot = findByName(index, name);
+    if (slot == -1) {
+        slot = appendSlot(&counterTable);
+        Counter* counter = counterAt(slot);
+        counter->name = name;
+        counter->kind = kind;
+        counter->potion = kind == COUNTER_POTION ? findByName(&potionsByName, name) : -1;
+        indexName(index, name, slot);
+    }
+    return slot;
+}
 
 
 /**
- * @brief Represents a magical sign.
+ * @brief Counters of one kind known for a beast, in increasing slot order.
  */
 typedef struct {
-    char name[MAX_TOKEN_LENGTH];  /**< Name of the sign */
-} Sign;
-
-/** Global list of known signs. */
-static Sign signs[MAX_SIGNS] = {0};
-
+    int* items;                   /**< Counter slots */
+    int count;                    /**< Number of counters */
+    int capacity;                 /**< Size of items */
+} CounterList;
 
 /**
  * @brief Represents a beast and its weaknesses to signs and potions.
  */
 typedef struct {
-    char name[MAX_TOKEN_LENGTH];                          /**< Name of the beast */
-    int effective_sign_indices[MAX_EFFECTIVENESS];        /**< Indices of effective signs */
-    int effective_signs_count;                            /**< Count of effective signs */
-    int effective_potion_indices[MAX_EFFECTIVENESS];      /**< Indices of effective potions */
-    int effective_potions_count;                          /**< Count of effective potions */
+    NameId name;                       /**< Interned name of the beast, 0 for a free slot */
+    CounterList effective_signs;       /**< Effective signs */
+    CounterList effective_potions;     /**< Effective potions */
+    unsigned version;                  /**< Incremented whenever a counter is added */
+    RenderedAnswer answer;             /**< Answer to "What is effective against" */
 } Beast;
 
-/** Global list of known beasts. */
-static Beast beasts[MAX_BEASTS] = {0};
+/**
+ * @brief Finds where a counter is, or belongs, in a list.
+ *
+ * @param list The list.
+ * @param counter The counter slot.
+ * @return Position of the first counter in the list not below the given one.
+ */
+static int findCounter(const CounterList* list, int counter) {
+    int low = 0;
+    int high = list->count;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (list->items[middle] < counter)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * @brief Inserts a counter into a list at the position found for it.
+ *
+ * The counters after it are moved up by one, which is cheap for the few
+ * counters a beast has.
+ *
+ * @param list The list.
+ * @param position Position returned by findCounter for the counter.
+ * @param counter The counter slot.
+ */
+static void insertCounter(CounterList* list, int position, int counter) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity > 0 ? list->capacity * 2 : 4;
+        list->items = xrealloc(list->items, capacity * sizeof(int));
+        list->capacity = capacity;
+    }
+
+    memmove(&list->items[position + 1], &list->items[position], (list->count - position) * sizeof(int));
+    list->items[position] = counter;
+    list->count++;
+}
 
+/** Global list of known beasts. */
+static EntityTable beastTable = { .entitySize = sizeof(Beast) };
+/** Slot of each beast name. */
+static NameIndex beastsByName = {0};
 
+/**
+ * @brief Returns a beast slot.
+ *
+ * @param slot The slot.
+ * @return The beast.
+ */
+static inline Beast* beastAt(int slot) {
+    return tableSlot(&beastTable, slot);
+}
 
 /**
  * @brief Executes the "Geralt loots" action by parsing and storing obtained ingredients.
  *
- * This function tokenizes the input command, extracts ingredient names and their
- * quantities, and updates the global ingredient list. If an ingredient is new,
+ * This function walks the ingredient names and quantities recorded by the parser
+ * and updates the global ingredient list. If an ingredient is new,
  * it is added to the list. If it already exists, its quantity is increased.
  *
  *
- * @param input The full command string starting with "Geralt loots".
+ * @param cmd The parsed "Geralt loots" command.
  * @return Always returns 0.
  */
-int executeLootAction(const char* input) {
+int executeLootAction(const Command* cmd) {
     
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Parse the input to extract ingredients and quantities
-    int token_index = 2; // Start after "Geralt loots"
-    
-    while (token_index < count) {
-        int quantity = atoi(tokens[token_index]);
-        token_index++;
+    for (int item = 0; item < cmd->itemCount; item++) {
+        int quantity = cmd->items[item].quantity;
         
         // Get the ingredient name
-        char ingredient_name[MAX_TOKEN_LENGTH] = {0};
-        strcpy(ingredient_name, tokens[token_index]);
-        token_index++;
+        NameId ingredient_name = cmd->items[item].nameId;
         
-        // Check if we already have this ingredient
-        int ingredient_index = -1;
-        for (int i = 0; i < num_ingredients; i++) {
-            if (strcmp(ingredients[i].name, ingredient_name) == 0) {
-                ingredient_index = i;
-                break;
-            }
-        }
+        // Check if we already have this ingredient, however it was added
+        int ingredient_index = findByName(&ingredientsByName, ingredient_name);
         
         // If ingredient doesn't exist yet, add it
         if (ingredient_index == -1) {
-            ingredient_index = num_ingredients;
-            strcpy(ingredients[num_ingredients].name, ingredient_name);
-            num_ingredients++;
+            ingredient_index = appendStock(&ingredients, ingredient_name);
+            indexName(&ingredientsByName, ingredient_name, ingredient_index);
         }
         
         // Update the quantity
-        ingredients[ingredient_index].quantity += quantity;
-        
-        // Skip comma if present
-        if (token_index < count && strcmp(tokens[token_index], ",") == 0) {
-            token_index++;
-        }
+        addStock(&ingredients, ingredient_index, quantity);
     }
 
     
     // Output the standard response
-    printf("Alchemy ingredients obtained\n");
+    writeString("Alchemy ingredients obtained\n");
 
     return 0;
 }
@@ -1730,90 +2794,45 @@ int executeLootAction(const char* input) {
 /**
  * @brief Executes the "Geralt trades" action by parsing and updating trophies and ingredients.
  *
- * This function tokenizes the input command, extracts trophy names and their
- * quantities, and updates the global trophy list. It also updates the ingredient
+ * This function takes the trophy names and quantities recorded by the parser
+ * and updates the global trophy list. It also updates the ingredient
  * list based on the trade.
  *
- * @param input The full command string starting with "Geralt trades".
+ * @param cmd The parsed "Geralt trades" command.
  * @return Always returns 0.
  */
 
-int executeTradeAction(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
+int executeTradeAction(const Command* cmd) {
     // Temporary arrays to store what trophies are required and what ingredients will be gained
     typedef struct {
-        char name[MAX_TOKEN_LENGTH];
+        NameId name;
         int quantity;
         int index;  // Index in the original arrays
     } TradeItem;
     
-    TradeItem required_trophies[MAX_INGREDIENTS] = {0};
-    TradeItem gained_ingredients[MAX_INGREDIENTS] = {0};
+    TradeItem* required_trophies = scratchAlloc((size_t)cmd->tradeSplit * sizeof(TradeItem));
+    TradeItem* gained_ingredients = scratchAlloc((size_t)(cmd->itemCount - cmd->tradeSplit) * sizeof(TradeItem));
     
     int num_required_trophies = 0;
     int num_gained_ingredients = 0;
     
-    // Parse the input to extract required trophies and gained ingredients
-    int token_index = 2; // Start after "Geralt trades"
-    int parsing_trophies = 1; // Flag to indicate if we're parsing trophies (1) or ingredients (0)
-    
-    while (token_index < count) {
-        // Check if we've reached the "for" token, which separates trophies from ingredients
-        if (strcmp(tokens[token_index], "for") == 0) {
-            parsing_trophies = 0;
-            token_index++;
-            continue;
-        }
+    // Split the recorded entries into required trophies and gained ingredients
+    for (int item = 0; item < cmd->itemCount; item++) {
+        NameId item_name = cmd->items[item].nameId;
         
-        // Parse quantity
-        int quantity = atoi(tokens[token_index]);
-        token_index++;
-        
-        // Parse name - might be multiple tokens until "trophy", comma, or "for"
-        char item_name[MAX_TOKEN_LENGTH * 3] = {0}; // Allow for longer names
-        
-        // For trophies, we need to handle special case where quantity might be followed by multiple
-        // words until we hit "trophy" or ","
-        if (parsing_trophies) {
-            while (token_index < count && 
-                   strcmp(tokens[token_index], "trophy") != 0 && 
-                   strcmp(tokens[token_index], ",") != 0 && 
-                   strcmp(tokens[token_index], "for") != 0) {
-                if (strlen(item_name) > 0) {
-                    strcat(item_name, " ");
-                }
-                strcat(item_name, tokens[token_index]);
-                token_index++;
-            }
-            
-            // Skip "trophy" token if present
-            if (token_index < count && strcmp(tokens[token_index], "trophy") == 0) {
-                token_index++;
-            }
-            
+        if (item < cmd->tradeSplit) {
             // Add to required trophies
-            strcpy(required_trophies[num_required_trophies].name, item_name);
-            required_trophies[num_required_trophies].quantity = quantity;
+            required_trophies[num_required_trophies].name = item_name;
+            required_trophies[num_required_trophies].quantity = cmd->items[item].quantity;
             required_trophies[num_required_trophies].index = -1; // Will set actual index later
             num_required_trophies++;
         } else {
-            // For ingredients, just get the name (should be a single token)
-            strcpy(item_name, tokens[token_index]);
-            token_index++;
-            
             // Add to gained ingredients
-            strcpy(gained_ingredients[num_gained_ingredients].name, item_name);
-            gained_ingredients[num_gained_ingredients].quantity = quantity;
+            gained_ingredients[num_gained_ingredients].name = item_name;
+            gained_ingredients[num_gained_ingredients].quantity = cmd->items[item].quantity;
             gained_ingredients[num_gained_ingredients].index = -1; // Will set actual index later
             num_gained_ingredients++;
         }
-        
-        // Skip comma if present
-        if (token_index < count && strcmp(tokens[token_index], ",") == 0) {
-            token_index++;
-        }
     }
     
     // Check if Geralt has enough trophies
@@ -1821,18 +2840,14 @@ int executeTradeAction(const char* input) {
     
     // Find indices of required trophies in the original trophies array
     for (int i = 0; i < num_required_trophies; i++) {
-        int trophy_index = -1;
-        
-        // Search for the trophy in Geralt's inventory
-        for (int j = 0; j < MAX_INGREDIENTS; j++) { // Assuming trophies array has MAX_INGREDIENTS elements
-            if (trophies[j].quantity > 0 && strcmp(trophies[j].name, required_trophies[i].name) == 0) {
-                trophy_index = j;
-                break;
-            }
+        // Search for the trophy in Geralt's inventory; trophy names are unique
+        int trophy_index = findByName(&trophiesByName, required_trophies[i].name);
+        if (trophy_index != -1 && trophies.quantities[trophy_index] <= 0) {
+            trophy_index = -1;
         }
         
         // Check if trophy exists and has enough quantity
-        if (trophy_index == -1 || trophies[trophy_index].quantity < required_trophies[i].quantity) {
+        if (trophy_index == -1 || trophies.quantities[trophy_index] < required_trophies[i].quantity) {
             has_enough_trophies = 0;
             break;
         }
@@ -1845,23 +2860,12 @@ int executeTradeAction(const char* input) {
         int ingredient_index = -1;
         
         // Search for the ingredient in Geralt's inventory
-        for (int j = 0; j < MAX_INGREDIENTS; j++) {
-            if (strlen(ingredients[j].name) > 0 && strcmp(ingredients[j].name, gained_ingredients[i].name) == 0) {
-                ingredient_index = j;
-                break;
-            }
-        }
+        ingredient_index = findByName(&ingredientsByName, gained_ingredients[i].name);
         
-        // If ingredient doesn't exist, find an empty slot
+        // If ingredient doesn't exist, take the next free slot
         if (ingredient_index == -1) {
-            for (int j = 0; j < MAX_INGREDIENTS; j++) {
-                if (strlen(ingredients[j].name) == 0) {
-                    ingredient_index = j;
-                    strcpy(ingredients[j].name, gained_ingredients[i].name);
-                    ingredients[j].quantity = 0;
-                    break;
-                }
-            }
+            ingredient_index = appendStock(&ingredients, gained_ingredients[i].name);
+            indexName(&ingredientsByName, gained_ingredients[i].name, ingredient_index);
         }
         
         gained_ingredients[i].index = ingredient_index;
@@ -1871,17 +2875,17 @@ int executeTradeAction(const char* input) {
     if (has_enough_trophies) {
         // Reduce trophies
         for (int i = 0; i < num_required_trophies; i++) {
-            trophies[required_trophies[i].index].quantity -= required_trophies[i].quantity;
+            addStock(&trophies, required_trophies[i].index, -required_trophies[i].quantity);
         }
         
         // Increase ingredients
         for (int i = 0; i < num_gained_ingredients; i++) {
-            ingredients[gained_ingredients[i].index].quantity += gained_ingredients[i].quantity;
+            addStock(&ingredients, gained_ingredients[i].index, gained_ingredients[i].quantity);
         }
         
-        printf("Trade successful\n");
+        writeString("Trade successful\n");
     } else {
-        printf("Not enough trophies\n");
+        writeString("Not enough trophies\n");
     }
     
     return 0;
@@ -1890,293 +2894,115 @@ int executeTradeAction(const char* input) {
 /**
  * @brief Executes the "Geralt brews" action by parsing and updating potion quantities.
  *
- * This function tokenizes the input command, extracts potion names, and updates
+ * This function looks up the potion named by the parsed command and updates
  * the global potion list. It checks if the required ingredients are available
  * before allowing the brew.
  *
- * @param input The full command string starting with "Geralt brews".
+ * @param cmd The parsed "Geralt brews" command.
  * @return 0 on success, -1 on failure.
  */
 
-int executeBrewAction(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Check if the command format is valid
-    if (count < 3 || strcmp(tokens[0], "Geralt") != 0 || strcmp(tokens[1], "brews") != 0) {
-        printf("Invalid command format\n");
-        return -1;  // This is an invalid command
-    }
-    
-    // Extract potion name - for brew action, the potion name is in tokens[2]
-    char potionName[MAX_TOKEN_LENGTH] = "";
-    strcpy(potionName, tokens[2]);
+int executeBrewAction(const Command* cmd) {
+    NameId potionName = cmd->subjectId;
     
     // Find the potion in the potions array
-    int potionIndex = -1;
-    for (int i = 0; i < MAX_POTIONS; i++) {
-        if (potions[i].name[0] != '\0' && strcmp(potions[i].name, potionName) == 0) {
-            potionIndex = i;
-            break;
-        }
-    }
+    int potionIndex = findByName(&potionsByName, potionName);
     
     // Check if the potion formula exists
     if (potionIndex == -1) {
-        printf("No formula for %s\n", potionName);
+        writeString("No formula for ");
+        writeSubject(cmd);
+        writeString("\n");
         return 0;  // Changed from -1 to 0 - command was valid but couldn't be executed
     }
     
     // Check if there are enough ingredients
-    Potion* potion = &potions[potionIndex];
+    Potion* potion = potionAt(potionIndex);
+    const RecipeEntry* recipe = potionRecipe(potion);
     int hasEnoughIngredients = 1;
     
     for (int i = 0; i < potion->ingredients_count; i++) {
-        int ingredientIndex = potion->ingredient_indices[i];
-        int requiredQuantity = potion->ingredient_quantities[i];
+        int ingredientIndex = recipe[i].ingredient;
+        int requiredQuantity = recipe[i].quantity;
         
-        if (ingredients[ingredientIndex].quantity < requiredQuantity) {
+        if (ingredients.quantities[ingredientIndex] < requiredQuantity) {
             hasEnoughIngredients = 0;
             break;
         }
     }
     
     if (!hasEnoughIngredients) {
-        printf("Not enough ingredients\n");
+        writeString("Not enough ingredients\n");
         return 0;  // Changed from -1 to 0 - command was valid but couldn't be executed
     }
     
     // If we have enough ingredients, brew the potion
     // Reduce the ingredients
     for (int i = 0; i < potion->ingredients_count; i++) {
-        int ingredientIndex = potion->ingredient_indices[i];
-        int requiredQuantity = potion->ingredient_quantities[i];
+        int ingredientIndex = recipe[i].ingredient;
+        int requiredQuantity = recipe[i].quantity;
         
-        ingredients[ingredientIndex].quantity -= requiredQuantity;
+        addStock(&ingredients, ingredientIndex, -requiredQuantity);
     }
     
     // Increase the potion quantity
-    potion->quantity++;
+    addStock(&potions, potionIndex, 1);
     
-    printf("Alchemy item created: %s\n", potionName);
+    writeString("Alchemy item created: ");
+    writeName(potionName);
+    writeString("\n");
     return 0;
 }
 
 /**
  * @brief Executes the "Geralt learns" action for effectiveness knowledge.
  *
- * This function tokenizes the input command, extracts the counter name (sign or potion),
- * type, and monster name, and updates the bestiary with effectiveness information.
+ * This function takes the counter name (sign or potion), type, and monster name
+ * recorded by the parser and updates the bestiary with effectiveness information.
  *
- * @param input The full command string starting with "Geralt learns".
+ * @param cmd The parsed "Geralt learns ... is effective against" command.
  * @return 0 on success, -1 on failure.
  */
-int executeEffectivenessKnowledge(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the counter name (sign or potion name), type, and monster name
-    char counter_name[MAX_TOKEN_LENGTH] = {0};
-    char counter_type[MAX_TOKEN_LENGTH] = {0}; // "sign" or "potion"
-    char monster_name[MAX_TOKEN_LENGTH] = {0};
+int executeEffectivenessKnowledge(const Command* cmd) {
+    // Counter name (sign or potion name) and monster name
+    NameId counter_name = cmd->subjectId;
+    NameId monster_name = cmd->targetId;
     
-    // Parse input to extract necessary information
-    strcpy(counter_name, tokens[2]); // Counter name is the 3rd token (index 2)
-    strcpy(counter_type, tokens[3]); // Counter type is the 4th token (index 3)
-    strcpy(monster_name, tokens[count-1]); // Monster name is the last token
+    // Potions are registered whether or not their formula is known yet
+    int counter = registerCounter(cmd->counterIsSign ? COUNTER_SIGN : COUNTER_POTION, counter_name);
     
     // Check if the monster already exists in the bestiary
-    int monster_index = -1;
-    for (int i = 0; i < MAX_BEASTS; i++) {
-        if (beasts[i].name[0] != '\0' && strcmp(beasts[i].name, monster_name) == 0) {
-            monster_index = i;
-            break;
-        }
-    }
+    int monster_index = findByName(&beastsByName, monster_name);
     
     // If monster doesn't exist, add it to the bestiary
     if (monster_index == -1) {
-        // Find an empty slot in the beasts array
-        for (int i = 0; i < MAX_BEASTS; i++) {
-            if (beasts[i].name[0] == '\0') {
-                monster_index = i;
-                strcpy(beasts[i].name, monster_name);
-                beasts[i].effective_potions_count = 0;
-                beasts[i].effective_signs_count = 0;
-                break;
-            }
-        }
+        // Take the next free slot in the beasts table
+        monster_index = appendSlot(&beastTable);
+        Beast* monster = beastAt(monster_index);
+        monster->name = monster_name;
+        indexName(&beastsByName, monster_name, monster_index);
         
         // Add the effectiveness information
-        if (strcmp(counter_type, "sign") == 0) {
-            // Check if sign exists in signs array, if not add it
-            int sign_index = -1;
-            for (int i = 0; i < MAX_SIGNS; i++) {
-                if (signs[i].name[0] != '\0' && strcmp(signs[i].name, counter_name) == 0) {
-                    sign_index = i;
-                    break;
-                }
-            }
-            
-            if (sign_index == -1) {
-                // Add new sign
-                for (int i = 0; i < MAX_SIGNS; i++) {
-                    if (signs[i].name[0] == '\0') {
-                        strcpy(signs[i].name, counter_name);
-                        sign_index = i;
-                        break;
-                    }
-                }
-            }
-            
-            // Add sign index to beast's effective signs
-            beasts[monster_index].effective_sign_indices[0] = sign_index;
-            beasts[monster_index].effective_signs_count = 1;
-        } else if (strcmp(counter_type, "potion") == 0) {
-            // For potions, we need to handle two cases:
-            // 1. If the potion formula is already known (exists in potions array)
-            // 2. If only the effectiveness is known (doesn't exist in potions array)
-            
-            int potion_index = -1;
-            
-            // First check if the potion formula is already known
-            for (int i = 0; i < MAX_POTIONS; i++) {
-                if (potions[i].name[0] != '\0' && strcmp(potions[i].name, counter_name) == 0) {
-                    potion_index = i;
-                    break;
-                }
-            }
-            
-            // If potion formula is not known, we need to create a special entry
-            if (potion_index == -1) {
-                // Create a special entry in the signs array to track this potion's name
-                // (We're repurposing the signs array to also store potion names that are only known for effectiveness)
-                for (int i = 0; i < MAX_SIGNS; i++) {
-                    if (signs[i].name[0] == '\0') {
-                        strcpy(signs[i].name, counter_name);
-                        potion_index = i + MAX_POTIONS; // Use an offset to distinguish from regular potion indices
-                        break;
-                    }
-                }
-            }
-            
-            // Add potion index to beast's effective potions
-            beasts[monster_index].effective_potion_indices[0] = potion_index;
-            beasts[monster_index].effective_potions_count = 1;
-        }
+        insertCounter(cmd->counterIsSign ? &monster->effective_signs : &monster->effective_potions, 0, counter);
+        monster->version++;
         
-        printf("New bestiary entry added: %s\n", monster_name);
+        writeString("New bestiary entry added: ");
+        writeName(monster_name);
+        writeString("\n");
     } else {
-        // Monster exists, check if the effectiveness is already known
-        if (strcmp(counter_type, "sign") == 0) {
-            // Check if this sign is already known to be effective
-            int sign_index = -1;
-            for (int i = 0; i < MAX_SIGNS; i++) {
-                if (signs[i].name[0] != '\0' && strcmp(signs[i].name, counter_name) == 0) {
-                    sign_index = i;
-                    break;
-                }
-            }
-            
-            if (sign_index == -1) {
-                // Add new sign
-                for (int i = 0; i < MAX_SIGNS; i++) {
-                    if (signs[i].name[0] == '\0') {
-                        strcpy(signs[i].name, counter_name);
-                        sign_index = i;
-                        break;
-                    }
-                }
-            }
-            
-            // Check if this sign is already known to be effective against this monster
-            int already_known = 0;
-            for (int i = 0; i < beasts[monster_index].effective_signs_count; i++) {
-                if (beasts[monster_index].effective_sign_indices[i] == sign_index) {
-                    already_known = 1;
-                    break;
-                }
-            }
-            
-            if (already_known) {
-                printf("Already known effectiveness\n");
-            } else {
-                // Add sign index to beast's effective signs
-                beasts[monster_index].effective_sign_indices[beasts[monster_index].effective_signs_count] = sign_index;
-                beasts[monster_index].effective_signs_count++;
-                printf("Bestiary entry updated: %s\n", monster_name);
-            }
-        } else if (strcmp(counter_type, "potion") == 0) {
-            // For potions, handle the same two cases as above
-            int potion_index = -1;
-            
-            // First check if the potion formula is already known
-            for (int i = 0; i < MAX_POTIONS; i++) {
-                if (potions[i].name[0] != '\0' && strcmp(potions[i].name, counter_name) == 0) {
-                    potion_index = i;
-                    break;
-                }
-            }
-            
-            // If potion formula is not known, check if we already have an effectiveness entry
-            if (potion_index == -1) {
-                for (int i = 0; i < MAX_SIGNS; i++) {
-                    if (signs[i].name[0] != '\0' && strcmp(signs[i].name, counter_name) == 0) {
-                        potion_index = i + MAX_POTIONS; // Use the same offset convention
-                        break;
-                    }
-                }
-                
-                // If no effectiveness entry exists yet, create one
-                if (potion_index == -1) {
-                    for (int i = 0; i < MAX_SIGNS; i++) {
-                        if (signs[i].name[0] == '\0') {
-                            strcpy(signs[i].name, counter_name);
-                            potion_index = i + MAX_POTIONS;
-                            break;
-                        }
-                    }
-                }
-            }
-            
-            // Check if this potion is already known to be effective against this monster
-            int already_known = 0;
-            for (int i = 0; i < beasts[monster_index].effective_potions_count; i++) {
-                int existing_index = beasts[monster_index].effective_potion_indices[i];
-                
-                // Direct index match
-                if (existing_index == potion_index) {
-                    already_known = 1;
-                    break;
-                }
-                
-                // Check if it's the same potion but with different index types
-                // (one regular index, one offset index)
-                if (existing_index < MAX_POTIONS && potion_index >= MAX_POTIONS) {
-                    // existing is regular, potion_index is offset
-                    int sign_index = potion_index - MAX_POTIONS;
-                    if (strcmp(potions[existing_index].name, signs[sign_index].name) == 0) {
-                        already_known = 1;
-                        break;
-                    }
-                } else if (existing_index >= MAX_POTIONS && potion_index < MAX_POTIONS) {
-                    // existing is offset, potion_index is regular
-                    int sign_index = existing_index - MAX_POTIONS;
-                    if (strcmp(signs[sign_index].name, potions[potion_index].name) == 0) {
-                        already_known = 1;
-                        break;
-                    }
-                }
-            }
-            
-            if (already_known) {
-                printf("Already known effectiveness\n");
-            } else {
-                // Add potion index to beast's effective potions
-                beasts[monster_index].effective_potion_indices[beasts[monster_index].effective_potions_count] = potion_index;
-                beasts[monster_index].effective_potions_count++;
-                printf("Bestiary entry updated: %s\n", monster_name);
-            }
+        // Monster exists, check if the counter is already known to be effective against it
+        Beast* monster = beastAt(monster_index);
+        CounterList* effective = cmd->counterIsSign ? &monster->effective_signs : &monster->effective_potions;
+        int position = findCounter(effective, counter);
+        
+        if (position < effective->count && effective->items[position] == counter) {
+            writeString("Already known effectiveness\n");
+        } else {
+            insertCounter(effective, position, counter);
+            monster->version++;
+            writeString("Bestiary entry updated: ");
+            writeName(monster_name);
+            writeString("\n");
         }
     }
     
@@ -2186,206 +3012,140 @@ int executeEffectivenessKnowledge(const char* input) {
 /**
  * @brief Executes the "Geralt learns" action for potion formula knowledge.
  *
- * This function tokenizes the input command, extracts the potion name and its
- * ingredients, and updates the potions array with the new formula.
+ * This function takes the potion name and its ingredients recorded by the
+ * parser and updates the potions array with the new formula.
  *
- * @param input The full command string starting with "Geralt learns".
+ * @param cmd The parsed "Geralt learns ... potion consists of" command.
  * @return 0 on success, -1 on failure.
  */
-int executeFormulaKnowledge(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the potion name
-    char potion_name[MAX_TOKEN_LENGTH] = {0};
-    strcpy(potion_name, tokens[2]);
-    
-    // Handle multi-word potion names (like "Black Blood")
-    if (strcmp(tokens[3], "potion") != 0) {
-        strcat(potion_name, " ");
-        strcat(potion_name, tokens[3]);
-        // If there are more words in the potion name, we would continue here
-    }
+int executeFormulaKnowledge(const Command* cmd) {
+    // The potion name, multi-word names (like "Black Blood") are a single token
+    NameId potion_name = cmd->subjectId;
     
     // Check if the potion already exists in the potions array
-    int potion_index = -1;
-    for (int i = 0; i < MAX_POTIONS; i++) {
-        if (potions[i].name[0] != '\0' && strcmp(potions[i].name, potion_name) == 0) {
-            potion_index = i;
-            break;
-        }
-    }
+    int potion_index = findByName(&potionsByName, potion_name);
     
     // If potion already exists, it's an already known formula
     if (potion_index != -1) {
-        printf("Already known formula\n");
+        writeString("Already known formula\n");
         return 0;
     }
     
-    // Find an empty slot for the new potion
-    for (int i = 0; i < MAX_POTIONS; i++) {
-        if (potions[i].name[0] == '\0') {
-            potion_index = i;
-            break;
-        }
-    }
-    
+    // Take the next free slot for the new potion
+    potion_index = appendPotion(potion_name);
+    Potion* potion = potionAt(potion_index);
     
     // Add the new potion
-    strcpy(potions[potion_index].name, potion_name);
-    potions[potion_index].ingredients_count = 0;
-    potions[potion_index].quantity = 0;  // Initialize quantity to 0
-    
-    // Find the index where ingredients start
-    int ingredients_start = 6; // Default position after "Geralt learns [potion] consists of"
-    
-    // Adjust if potion name has multiple words
-    if (strcmp(tokens[3], "potion") != 0) {
-        ingredients_start++;
-    }
-    
-    // Parse the ingredients
-    for (int i = ingredients_start; i < count; i++) {
-        // Extract quantity
-        int quantity = atoi(tokens[i]);
-        i++; // Move to ingredient name
-        
-        // Extract ingredient name
-        char ingredient_name[MAX_TOKEN_LENGTH] = {0};
-        strcpy(ingredient_name, tokens[i]);
-        
-        // Remove trailing comma if present
-        int len = strlen(ingredient_name);
-        if (len > 0 && ingredient_name[len-1] == ',') {
-            ingredient_name[len-1] = '\0';
-        }
+    indexName(&potionsByName, potion_name, potion_index);
+    
+    // Link the counter of a potion already known to be effective against a beast
+    int counter = findByName(&potionCountersByName, potion_name);
+    if (counter != -1) {
+        counterAt(counter)->potion = potion_index;
+    }
+    
+    // The recipe is appended to the arena; formulas are never changed once learned,
+    // so it is sorted and its "What is in" answer rendered here, once
+    reserveBuffer((void**)&recipeArena, &recipeArenaCapacity,
+                  (size_t)(recipeArenaLength + cmd->itemCount) * sizeof(RecipeEntry));
+    potion->recipe_offset = recipeArenaLength;
+    RecipeEntry* recipe = recipeArena + recipeArenaLength;
+    recipeArenaLength += cmd->itemCount;
+    
+    // Add the ingredients
+    for (int item = 0; item < cmd->itemCount; item++) {
+        int quantity = cmd->items[item].quantity;
+        NameId ingredient_name = cmd->items[item].nameId;
         
         // Find or add the ingredient
         int ingredient_index = -1;
         
         // First, search for an existing ingredient with the same name
-        for (int j = 0; j < MAX_INGREDIENTS; j++) {
-            if (ingredients[j].name[0] != '\0' && strcmp(ingredients[j].name, ingredient_name) == 0) {
-                ingredient_index = j;
-                break;
-            }
-        }
+        ingredient_index = findByName(&ingredientsByName, ingredient_name);
         
         // If ingredient doesn't exist, add it
         if (ingredient_index == -1) {
-            for (int j = 0; j < MAX_INGREDIENTS; j++) {
-                if (ingredients[j].name[0] == '\0') {
-                    ingredient_index = j;
-                    strcpy(ingredients[j].name, ingredient_name);
-                    ingredients[j].quantity = 0; // Initialize quantity
-                    num_ingredients++; // Increment the global count of ingredients
-                    break;
-                }
-            }
+            ingredient_index = appendStock(&ingredients, ingredient_name);
+            indexName(&ingredientsByName, ingredient_name, ingredient_index);
         }
         
-        // Add ingredient to potion's ingredients list
-        potions[potion_index].ingredient_indices[potions[potion_index].ingredients_count] = ingredient_index;
-        potions[potion_index].ingredient_quantities[potions[potion_index].ingredients_count] = quantity;
-        potions[potion_index].ingredients_count++;
-        
-        // Skip comma token if present
-        if (i+1 < count && strcmp(tokens[i+1], ",") == 0) {
-            i++;
+        // Insert the ingredient into the sorted recipe
+        RecipeEntry entry = { ingredient_index, quantity };
+        int position = potion->ingredients_count;
+        while (position > 0 && recipeEntryPrecedes(&entry, &recipe[position - 1])) {
+            recipe[position] = recipe[position - 1];
+            position--;
         }
+        recipe[position] = entry;
+        potion->ingredients_count++;
     }
     
-    potionsCount++;
+    // Render the answer to "What is in"
+    RenderedAnswer* answer = &potion->answer;
+    for (int i = 0; i < potion->ingredients_count; i++) {
+        appendAnswerInt(answer, recipe[i].quantity);
+        appendAnswer(answer, " ", 1);
+        appendAnswerName(answer, ingredients.names[recipe[i].ingredient]);
+        if (i < potion->ingredients_count - 1) {
+            appendAnswer(answer, ", ", 2);
+        }
+    }
+    appendAnswer(answer, "\n", 1);
 
     // Output success message
-    printf("New alchemy formula obtained: %s\n", potion_name);
+    writeString("New alchemy formula obtained: ");
+    writeName(potion_name);
+    writeString("\n");
     return 0;
 }
 
 /**
  * @brief Executes the "Geralt encounters" action by checking for effective potions and signs.
  *
- * This function tokenizes the input command, extracts the monster name, and checks
+ * This function takes the monster name recorded by the parser and checks
  * if Geralt has effective potions or signs to counter the monster.
  *
- * @param input The full command string starting with "Geralt encounters".
+ * @param cmd The parsed "Geralt encounters" command.
  * @return 0 on success, -1 on failure.
  */
-int executeEncounter(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the monster name (should be the 4th token)
-    if (count < 4) {
-        printf("Invalid encounter format\n");
-        return -1;
-    }
-    
-    char monsterName[MAX_TOKEN_LENGTH];
-    strcpy(monsterName, tokens[3]);
+int executeEncounter(const Command* cmd) {
+    NameId monsterName = cmd->subjectId;
     
     // Check if the monster exists in the bestiary
-    int monsterIndex = -1;
-    for (int i = 0; i < MAX_BEASTS; i++) {
-        if (beasts[i].name[0] != '\0' && strcmp(beasts[i].name, monsterName) == 0) {
-            monsterIndex = i;
-            break;
-        }
-    }
+    int monsterIndex = findByName(&beastsByName, monsterName);
     
     // If monster is not in the bestiary, Geralt is unprepared
     if (monsterIndex == -1) {
-        printf("Geralt is unprepared and barely escapes with his life\n");
+        writeString("Geralt is unprepared and barely escapes with his life\n");
         return 0;
     }
     
     // Check if Geralt has any effective potions or signs
-    Beast* monster = &beasts[monsterIndex];
+    Beast* monster = beastAt(monsterIndex);
     bool hasEffectiveCounter = false;
     
     // Check for effective potions that are in inventory
     bool hasEffectivePotions = false;
-    for (int i = 0; i < monster->effective_potions_count; i++) {
-        int potionIndex = monster->effective_potion_indices[i];
-        
-        // If it's a regular potion index
-        if (potionIndex < MAX_POTIONS) {
-            if (potions[potionIndex].quantity > 0) {
-                hasEffectiveCounter = true;
-                hasEffectivePotions = true;
-                break;
-            }
-        }
-        // If it's an effectiveness-only potion index (with offset)
-        else {
-            // Find the actual potion by name
-            int signIndex = potionIndex - MAX_POTIONS;
-            char* potionName = signs[signIndex].name;
-            
-            // Search for this potion in the potions array
-            for (int j = 0; j < MAX_POTIONS; j++) {
-                if (potions[j].name[0] != '\0' && 
-                    strcmp(potions[j].name, potionName) == 0 &&
-                    potions[j].quantity > 0) {
-                    hasEffectiveCounter = true;
-                    hasEffectivePotions = true;
-                    break;
-                }
-            }
-            if (hasEffectivePotions) break;
+    for (int i = 0; i < monster->effective_potions.count; i++) {
+        // Potions whose formula is still unknown cannot be in the inventory
+        int potionIndex = counterAt(monster->effective_potions.items[i])->potion;
+        if (potionIndex != -1 && potions.quantities[potionIndex] > 0) {
+            hasEffectiveCounter = true;
+            hasEffectivePotions = true;
+            break;
         }
     }
     
     // Check for effective signs
     bool hasEffectiveSigns = false;
-    if (!hasEffectiveCounter && monster->effective_signs_count > 0) {
+    if (!hasEffectiveCounter && monster->effective_signs.count > 0) {
         hasEffectiveCounter = true;
         hasEffectiveSigns = true;
     }
     
     // If Geralt has no effective counter, he barely escapes
     if (!hasEffectiveCounter) {
-        printf("Geralt is unprepared and barely escapes with his life\n");
+        writeString("Geralt is unprepared and barely escapes with his life\n");
         return 0;
     }
     
@@ -2393,117 +3153,65 @@ int executeEncounter(const char* input) {
     
     // Consume one of each effective potion in inventory
     if (hasEffectivePotions) {
-        for (int i = 0; i < monster->effective_potions_count; i++) {
-            int potionIndex = monster->effective_potion_indices[i];
-            
-            // If it's a regular potion index
-            if (potionIndex < MAX_POTIONS) {
-                if (potions[potionIndex].quantity > 0) {
-                    potions[potionIndex].quantity--;
-                }
-            }
-            // If it's an effectiveness-only potion index (with offset)
-            else {
-                // Find the actual potion by name
-                int signIndex = potionIndex - MAX_POTIONS;
-                char* potionName = signs[signIndex].name;
-                
-                // Search for this potion in the potions array and consume one
-                for (int j = 0; j < MAX_POTIONS; j++) {
-                    if (potions[j].name[0] != '\0' && 
-                        strcmp(potions[j].name, potionName) == 0 &&
-                        potions[j].quantity > 0) {
-                        potions[j].quantity--;
-                        break;
-                    }
-                }
+        for (int i = 0; i < monster->effective_potions.count; i++) {
+            int potionIndex = counterAt(monster->effective_potions.items[i])->potion;
+            if (potionIndex != -1 && potions.quantities[potionIndex] > 0) {
+                addStock(&potions, potionIndex, -1);
             }
         }
     }
     
     // Add trophy to inventory
-    int trophyIndex = -1;
-    for (int i = 0; i < MAX_TROPHIES; i++) {
-        if (trophies[i].name[0] != '\0' && strcmp(trophies[i].name, monsterName) == 0) {
-            trophyIndex = i;
-            break;
-        }
-    }
+    int trophyIndex = findByName(&trophiesByName, monsterName);
     
     if (trophyIndex == -1) {
-        // Trophy doesn't exist yet, find an empty slot
-        for (int i = 0; i < MAX_TROPHIES; i++) {
-            if (trophies[i].name[0] == '\0') {
-                trophyIndex = i;
-                strcpy(trophies[i].name, monsterName);
-                trophies[i].quantity = 0;
-                break;
-            }
-        }
+        // Trophy doesn't exist yet, take the next free slot
+        trophyIndex = appendStock(&trophies, monsterName);
+        indexName(&trophiesByName, monsterName, trophyIndex);
     }
     
     // Increment trophy quantity
-    if (trophyIndex != -1) {
-        trophies[trophyIndex].quantity++;
-    }
+    addStock(&trophies, trophyIndex, 1);
     
-    printf("Geralt defeats %s\n", monsterName);
+    writeString("Geralt defeats ");
+    writeName(monsterName);
+    writeString("\n");
     return 0;
 }
 
 /**
  * @brief Executes the "Geralt checks" action for inventory queries.
  *
- * This function tokenizes the input command, extracts the category and item name,
+ * This function takes the category and item name recorded by the parser
  * and checks the inventory for the specified item.
  *
- * @param input The full command string starting with "Geralt checks".
+ * @param cmd The parsed "Total <category> <item> ?" query.
  * @return 0 on success, -1 on failure.
  */
-int executeSpecificInventoryQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the category and item name
-    char category[MAX_TOKEN_LENGTH];
-    strcpy(category, tokens[1]);
-    
-    char itemName[MAX_TOKEN_LENGTH];
-    strcpy(itemName, tokens[2]);
+int executeSpecificInventoryQuery(const Command* cmd) {
+    NameId itemName = cmd->subjectId;
     
     // Handle different categories
-    if (strcmp(category, "ingredient") == 0) {
+    if (cmd->category == CATEGORY_INGREDIENT) {
         // Search for the ingredient
-        int quantity = 0;
-        for (int i = 0; i < MAX_INGREDIENTS; i++) {
-            if (ingredients[i].name[0] != '\0' && strcmp(ingredients[i].name, itemName) == 0) {
-                quantity = ingredients[i].quantity;
-                break;
-            }
-        }
-        printf("%d\n", quantity);
+        int index = findByName(&ingredientsByName, itemName);
+        int quantity = index != -1 ? ingredients.quantities[index] : 0;
+        writeInt(quantity);
+        writeString("\n");
     }
-    else if (strcmp(category, "potion") == 0) {
+    else if (cmd->category == CATEGORY_POTION) {
         // Search for the potion
-        int quantity = 0;
-        for (int i = 0; i < MAX_POTIONS; i++) {
-            if (potions[i].name[0] != '\0' && strcmp(potions[i].name, itemName) == 0) {
-                quantity = potions[i].quantity;
-                break;
-            }
-        }
-        printf("%d\n", quantity);
+        int index = findByName(&potionsByName, itemName);
+        int quantity = index != -1 ? potions.quantities[index] : 0;
+        writeInt(quantity);
+        writeString("\n");
     }
-    else if (strcmp(category, "trophy") == 0) {
+    else if (cmd->category == CATEGORY_TROPHY) {
         // Search for the trophy
-        int quantity = 0;
-        for (int i = 0; i < MAX_TROPHIES; i++) {
-            if (trophies[i].name[0] != '\0' && strcmp(trophies[i].name, itemName) == 0) {
-                quantity = trophies[i].quantity;
-                break;
-            }
-        }
-        printf("%d\n", quantity);
+        int index = findByName(&trophiesByName, itemName);
+        int quantity = index != -1 ? trophies.quantities[index] : 0;
+        writeInt(quantity);
+        writeString("\n");
     }
     
     return 0;
@@ -2512,91 +3220,45 @@ int executeSpecificInventoryQuery(const char* input) {
 /**
  * @brief Executes the "Geralt checks all" action for inventory queries.
  *
- * This function tokenizes the input command, extracts the category, and checks
+ * This function takes the category recorded by the parser and checks
  * the inventory for all items in that category.
  *
- * @param input The full command string starting with "Geralt checks all".
+ * @param cmd The parsed "Total <category> ?" query.
  * @return 0 on success, -1 on failure.
  */
-int executeAllInventoryQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the category
-    char category[MAX_TOKEN_LENGTH];
-    strcpy(category, tokens[1]);
-    
-    // Temporary array to store items for sorting
-    typedef struct {
-        char name[MAX_TOKEN_LENGTH];
-        int quantity;
-    } InventoryItem;
-    
-    InventoryItem items[MAX_ITEMS];
-    int itemCount = 0;
-    
-    // Handle different categories
-    if (strcmp(category, "ingredient") == 0) {
-        // Collect all ingredients with non-zero quantity
-        for (int i = 0; i < MAX_INGREDIENTS; i++) {
-            if (ingredients[i].name[0] != '\0' && ingredients[i].quantity > 0) {
-                strcpy(items[itemCount].name, ingredients[i].name);
-                items[itemCount].quantity = ingredients[i].quantity;
-                itemCount++;
-            }
-        }
+int executeAllInventoryQuery(const Command* cmd) {
+    // Pick the stock of the requested category
+    StockTable* stock;
+    if (cmd->category == CATEGORY_INGREDIENT) {
+        stock = &ingredients;
     }
-    else if (strcmp(category, "potion") == 0) {
-        // Collect all potions with non-zero quantity
-        for (int i = 0; i < MAX_POTIONS; i++) {
-            if (potions[i].name[0] != '\0' && potions[i].quantity > 0) {
-                strcpy(items[itemCount].name, potions[i].name);
-                items[itemCount].quantity = potions[i].quantity;
-                itemCount++;
-            }
-        }
+    else if (cmd->category == CATEGORY_POTION) {
+        stock = &potions;
     }
-    else if (strcmp(category, "trophy") == 0) {
-        // Collect all trophies with non-zero quantity
-        for (int i = 0; i < MAX_TROPHIES; i++) {
-            if (trophies[i].name[0] != '\0' && trophies[i].quantity > 0) {
-                strcpy(items[itemCount].name, trophies[i].name);
-                items[itemCount].quantity = trophies[i].quantity;
-                itemCount++;
-            }
-        }
+    else if (cmd->category == CATEGORY_TROPHY) {
+        stock = &trophies;
     }
     else {
-        printf("Invalid category\n");
+        writeString("Invalid category\n");
         return -1;
     }
     
     // Check if there are any items
-    if (itemCount == 0) {
-        printf("None\n");
+    if (stock->head[0] == 0) {
+        writeString("None\n");
         return 0;
     }
     
-    // Sort items alphabetically by name
-    for (int i = 0; i < itemCount - 1; i++) {
-        for (int j = 0; j < itemCount - i - 1; j++) {
-            if (strcmp(items[j].name, items[j+1].name) > 0) {
-                // Swap items
-                InventoryItem temp = items[j];
-                items[j] = items[j+1];
-                items[j+1] = temp;
-            }
-        }
-    }
-    
-    // Format and print the output
-    for (int i = 0; i < itemCount; i++) {
-        printf("%d %s", items[i].quantity, items[i].name);
-        if (i < itemCount - 1) {
-            printf(", ");
+    // Format and print the output, following the name-ordered list of items in stock
+    for (int i = stock->head[0] - 1; i != -1; i = *stockLink(stock, i, 0) - 1) {
+        if (i != stock->head[0] - 1) {
+            writeString(", ");
         }
+        writeInt(stock->quantities[i]);
+        writeString(" ");
+        writeName(stock->names[i]);
     }
-    printf("\n");
+    writeString("\n");
     
     return 0;
 }
@@ -2604,73 +3266,59 @@ int executeAllInventoryQuery(const char* input) {
 /**
  * @brief Executes the "Geralt checks" action for bestiary queries.
  *
- * This function tokenizes the input command, extracts the monster name, and checks
+ * This function takes the monster name recorded by the parser and checks
  * the bestiary for effective potions and signs against that monster.
  *
- * @param input The full command string starting with "Geralt checks".
+ * @param cmd The parsed "What is effective against" query.
  * @return 0 on success, -1 on failure.
  */
-int executeBestiaryQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the monster name (should be the 5th token)
-    char monsterName[MAX_TOKEN_LENGTH];
-    strcpy(monsterName, tokens[4]);
+int executeBestiaryQuery(const Command* cmd) {
+    NameId monsterName = cmd->subjectId;
     
     // Check if the monster exists in the bestiary
-    int monsterIndex = -1;
-    for (int i = 0; i < MAX_BEASTS; i++) {
-        if (beasts[i].name[0] != '\0' && strcmp(beasts[i].name, monsterName) == 0) {
-            monsterIndex = i;
-            break;
-        }
-    }
+    int monsterIndex = findByName(&beastsByName, monsterName);
     
     // If monster is not in the bestiary, Geralt has no knowledge of it
     if (monsterIndex == -1) {
-        printf("No knowledge of %s\n", monsterName);
+        writeString("No knowledge of ");
+        writeSubject(cmd);
+        writeString("\n");
         return 0;
     }
     
-    // Collect all effective potions and signs
-    Beast* monster = &beasts[monsterIndex];
+    // Write the cached answer if no counter was added since it was rendered
+    Beast* monster = beastAt(monsterIndex);
+    RenderedAnswer* answer = &monster->answer;
+    if (answer->length > 0 && answer->version == monster->version) {
+        writeOutput(answer->text, answer->length);
+        return 0;
+    }
     
     // Temporary array to store effective items for sorting
     typedef struct {
-        char name[MAX_TOKEN_LENGTH];
+        NameId name;
     } EffectiveItem;
     
-    EffectiveItem effectiveItems[MAX_EFFECTIVENESS * 2]; // Max possible items
+    EffectiveItem* effectiveItems = scratchAlloc(
+        (size_t)(monster->effective_potions.count + monster->effective_signs.count) * sizeof(EffectiveItem));
     int itemCount = 0;
     
-    // Add effective potions
-    for (int i = 0; i < monster->effective_potions_count; i++) {
-        int potionIndex = monster->effective_potion_indices[i];
-        
-        // Handle regular potions vs. effectiveness-only potions
-        if (potionIndex < MAX_POTIONS) {
-            // Regular potion (formula is known)
-            strcpy(effectiveItems[itemCount].name, potions[potionIndex].name);
-        } else {
-            // Effectiveness-only potion (formula not known)
-            int signIndex = potionIndex - MAX_POTIONS;
-            strcpy(effectiveItems[itemCount].name, signs[signIndex].name);
-        }
+    // Add effective potions, whether or not their formula is known
+    for (int i = 0; i < monster->effective_potions.count; i++) {
+        effectiveItems[itemCount].name = counterAt(monster->effective_potions.items[i])->name;
         itemCount++;
     }
     
     // Add effective signs
-    for (int i = 0; i < monster->effective_signs_count; i++) {
-        int signIndex = monster->effective_sign_indices[i];
-        strcpy(effectiveItems[itemCount].name, signs[signIndex].name);
+    for (int i = 0; i < monster->effective_signs.count; i++) {
+        effectiveItems[itemCount].name = counterAt(monster->effective_signs.items[i])->name;
         itemCount++;
     }
     
     // Sort items alphabetically by name
     for (int i = 0; i < itemCount - 1; i++) {
         for (int j = 0; j < itemCount - i - 1; j++) {
-            if (strcmp(effectiveItems[j].name, effectiveItems[j+1].name) > 0) {
+            if (strcmp(nameText(effectiveItems[j].name), nameText(effectiveItems[j+1].name)) > 0) {
                 // Swap items
                 EffectiveItem temp = effectiveItems[j];
                 effectiveItems[j] = effectiveItems[j+1];
@@ -2679,14 +3327,17 @@ int executeBestiaryQuery(const char* input) {
         }
     }
     
-    // Format and print the output
+    // Format the answer, keep it for later queries, and print it
+    answer->length = 0;
     for (int i = 0; i < itemCount; i++) {
-        printf("%s", effectiveItems[i].name);
+        appendAnswerName(answer, effectiveItems[i].name);
         if (i < itemCount - 1) {
-            printf(", ");
+            appendAnswer(answer, ", ", 2);
         }
     }
-    printf("\n");
+    appendAnswer(answer, "\n", 1);
+    answer->version = monster->version;
+    writeOutput(answer->text, answer->length);
     
     return 0;
 }
@@ -2694,89 +3345,29 @@ int executeBestiaryQuery(const char* input) {
 /**
  * @brief Executes the "Geralt brews" action by checking for potion formulas.
  *
- * This function tokenizes the input command, extracts the potion name, and checks
+ * This function takes the potion name recorded by the parser and checks
  * if Geralt has the formula for that potion.
  *
- * @param input The full command string starting with "Geralt brews".
+ * @param cmd The parsed "What is in" query.
  * @return 0 on success, -1 on failure.
  */
-int executeAlchemyQuery(const char* input) {
-    char tokens[MAX_TOKENS][MAX_TOKEN_LENGTH];
-    int count = tokenizeInput(input, tokens);
-    
-    // Extract the potion name (should be the 4th token)
-    char potionName[MAX_TOKEN_LENGTH];
-    strcpy(potionName, tokens[3]);
+int executeAlchemyQuery(const Command* cmd) {
+    NameId potionName = cmd->subjectId;
     
     // Check if the potion exists in Geralt's knowledge
-    int potionIndex = -1;
-    for (int i = 0; i < MAX_POTIONS; i++) {
-        if (potions[i].name[0] != '\0' && strcmp(potions[i].name, potionName) == 0) {
-            potionIndex = i;
-            break;
-        }
-    }
+    int potionIndex = findByName(&potionsByName, potionName);
     
     // If potion is not known, Geralt doesn't have the formula
     if (potionIndex == -1) {
-        printf("No formula for %s\n", potionName);
+        writeString("No formula for ");
+        writeSubject(cmd);
+        writeString("\n");
         return 0;
     }
     
-    // Get the potion and its ingredients
-    Potion* potion = &potions[potionIndex];
-    
-    // Temporary array to store ingredients for sorting
-    typedef struct {
-        char name[MAX_TOKEN_LENGTH];
-        int quantity;
-    } PotionIngredient;
-    
-    PotionIngredient potionIngredients[MAX_POTION_INGREDIENTS];
-    int ingredientCount = 0;
-    
-    // Collect all ingredients and their quantities
-    for (int i = 0; i < potion->ingredients_count; i++) {
-        int ingredientIndex = potion->ingredient_indices[i];
-    
-        
-        // Ensure the ingredient index is valid
-        if (ingredientIndex >= 0 && ingredientIndex < MAX_INGREDIENTS && ingredients[ingredientIndex].name[0] != '\0') {
-            strcpy(potionIngredients[ingredientCount].name, ingredients[ingredientIndex].name);
-            potionIngredients[ingredientCount].quantity = potion->ingredient_quantities[i];
-            ingredientCount++;
-        }
-    }
-    
-    // Sort ingredients first by quantity (descending) and then by name
-    for (int i = 0; i < ingredientCount - 1; i++) {
-        for (int j = 0; j < ingredientCount - i - 1; j++) {
-            // Sort by quantity (descending)
-            if (potionIngredients[j].quantity < potionIngredients[j+1].quantity) {
-                // Swap ingredients
-                PotionIngredient temp = potionIngredients[j];
-                potionIngredients[j] = potionIngredients[j+1];
-                potionIngredients[j+1] = temp;
-            }
-            // If quantities are equal, sort by name (alphabetically)
-            else if (potionIngredients[j].quantity == potionIngredients[j+1].quantity &&
-                     strcmp(potionIngredients[j].name, potionIngredients[j+1].name) > 0) {
-                // Swap ingredients
-                PotionIngredient temp = potionIngredients[j];
-                potionIngredients[j] = potionIngredients[j+1];
-                potionIngredients[j+1] = temp;
-            }
-        }
-    }
-    
-    // Format and print the output
-    for (int i = 0; i < ingredientCount; i++) {
-        printf("%d %s", potionIngredients[i].quantity, potionIngredients[i].name);
-        if (i < ingredientCount - 1) {
-            printf(", ");
-        }
-    }
-    printf("\n");
+    // The answer was rendered when the formula was learned
+    const RenderedAnswer* answer = &potionAt(potionIndex)->answer;
+    writeOutput(answer->text, answer->length);
     
     return 0;
 }
\ No newline at end of file